@@ -0,0 +1,269 @@
+#include <pthread.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <poll.h>
+
+#include "dispatch.h"
+#include "config.h"
+#include "serial.h"
+#include "sanyo.h"
+#include "cache.h"
+
+typedef struct Field {
+   const char *name;                  ///< argument of the status command
+   const char *key;                   ///< tunable that overrides the ttl
+   int ttl;                           ///< lifetime in ms, 0 disables caching
+   char value[STRING_SIZE];
+   long stamp;                        ///< time of the last read in ms
+   long used;                         ///< time a client last asked for the field in ms
+   int valid;
+   int pending;                       ///< refresh queued, executor must read the device
+} Field;
+
+static const Field template[] = {
+   { "power", "CACHE_TTL_POWER", CACHE_TTL_POWER },
+   { "input", "CACHE_TTL_INPUT", CACHE_TTL_INPUT },
+   { "lamp",  "CACHE_TTL_LAMP",  CACHE_TTL_LAMP  },
+   { "temp",  "CACHE_TTL_TEMP",  CACHE_TTL_TEMP  }
+};
+
+#define FIELDS (sizeof (template) / sizeof (template[0]))
+
+// one set of fields per device slot
+static Field field[DEVICE_MAX][FIELDS];
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_t cache_tid;
+static int stop_pipe[2] = { -1, -1 };
+
+static Queue **cache_queue = NULL;
+
+static Field *
+LookupField(Device *dev, const char *cmd, const char *arg) {
+   Field *f = field[DeviceIndex(dev)];
+
+   if ((dev->protocol != DEVICE_SANYO) || strcmp(cmd, "status")) return (NULL);
+
+   for (int i=0; i<FIELDS; i++) {
+      if (!strcmp(f[i].name, arg)) return (&f[i]);
+   }
+
+   return (NULL);
+}
+
+static int
+IsFresh(Field *f, long now) {
+   return ((f->ttl > 0) && f->valid && (now - f->stamp < f->ttl));
+}
+
+static int
+IsWanted(Field *f, long now) {
+   return ((f->ttl > 0) && f->used && (now - f->used < f->ttl));
+}
+
+static void
+Invalidate(Device *dev, const char *name) {
+   Field *f = field[DeviceIndex(dev)];
+
+   for (int i=0; i<FIELDS; i++) {
+      if (name && strcmp(f[i].name, name)) continue;
+
+      // a zero stamp makes the poller pick the field up right away
+      f[i].valid = 0;
+      f[i].stamp = 0;
+   }
+}
+
+static void
+RefreshDone(Request *req) {
+   free(req);
+}
+
+static void
+Refresh(Queue *queue, Field *f) {
+   Request *req;
+
+   if ((req = malloc(sizeof (Request)))) {
+      memset(req, 0, sizeof (Request));
+
+      strcpy(req->command[0].cmd, "status");
+      strcpy(req->command[0].arg, f->name);
+      req->count = 1;
+      req->done = RefreshDone;
+
+      if (!QueueSubmit(queue, req)) return;
+
+      free(req);
+   }
+
+   // try again on the next round
+   pthread_mutex_lock(&cache_lock);
+   f->pending = 0;
+   pthread_mutex_unlock(&cache_lock);
+}
+
+static void *
+CacheThread(void *arg) {
+   struct pollfd pfd;
+   long now;
+   int due;
+
+   pfd.fd = stop_pipe[0];
+   pfd.events = POLLIN;
+
+   while (poll(&pfd, 1, CACHE_POLL_INTERVAL) <= 0) {
+      now = SerialTimestamp();
+
+      for (int d=0; d<DEVICE_MAX; d++) {
+         Device *dev = DeviceSlot(d);
+
+         // nothing to read from an unplugged projector
+         if ((dev->protocol != DEVICE_SANYO) || !dev->serial) continue;
+
+         for (int i=0; i<FIELDS; i++) {
+            Field *f = &field[d][i];
+
+            pthread_mutex_lock(&cache_lock);
+
+            // refresh ahead of expiry, so readers never see a stale field,
+            // but only fields somebody asked for within their lifetime, the
+            // others are read on the next miss
+            due = IsWanted(f, now) && !f->pending && (now - f->stamp >= f->ttl - f->ttl / 4);
+
+            if (due) f->pending = 1;
+
+            pthread_mutex_unlock(&cache_lock);
+
+            if (due) Refresh(cache_queue[d], f);
+         }
+      }
+   }
+
+   return (NULL);
+}
+
+int
+CacheStart(Queue *queue[]) {
+   cache_queue = queue;
+
+   for (int d=0; d<DEVICE_MAX; d++) {
+      for (int i=0; i<FIELDS; i++) {
+         field[d][i] = template[i];
+         field[d][i].ttl = ConfigInteger(template[i].key, template[i].ttl);
+      }
+   }
+
+   if (pipe(stop_pipe)) {
+      return (OPEN_FAILED);
+   }
+
+   if (pthread_create(&cache_tid, NULL, CacheThread, NULL)) {
+      close(stop_pipe[0]);
+      close(stop_pipe[1]);
+      stop_pipe[0] = stop_pipe[1] = -1;
+      return (OPEN_FAILED);
+   }
+
+   return (0);
+}
+
+int
+CacheStop(void) {
+   if (stop_pipe[1] < 0) return (0);
+
+   // wake up and terminate the poller thread
+   if (write(stop_pipe[1], "", 1) == 1) {
+      pthread_join(cache_tid, NULL);
+   }
+
+   close(stop_pipe[0]);
+   close(stop_pipe[1]);
+
+   stop_pipe[0] = stop_pipe[1] = -1;
+
+   return (0);
+}
+
+int
+CacheRead(Device *dev, char ret[], const char *cmd, const char *arg) {
+   Field *f = LookupField(dev, cmd, arg);
+   int hit = 0;
+
+   if (!f) return (-1);
+
+   pthread_mutex_lock(&cache_lock);
+
+   f->used = SerialTimestamp();
+
+   if ((hit = IsFresh(f, f->used))) {
+      snprintf(ret, STRING_SIZE, "%s", f->value);
+   }
+
+   pthread_mutex_unlock(&cache_lock);
+
+   return ((hit) ? 0 : -1);
+}
+
+int
+CacheExecute(Device *dev, char ret[], const char *cmd, const char *arg) {
+   Field *f = LookupField(dev, cmd, arg);
+   int err, hit = 0;
+
+   if (f) {
+      pthread_mutex_lock(&cache_lock);
+
+      // a queued refresh has to go to the device, everybody else may use memory
+      if (!f->pending) {
+         f->used = SerialTimestamp();
+
+         if ((hit = IsFresh(f, f->used))) {
+            snprintf(ret, STRING_SIZE, "%s", f->value);
+         }
+      }
+
+      pthread_mutex_unlock(&cache_lock);
+
+      if (hit) return (0);
+   }
+
+   err = DispatchCommand(dev, ret, cmd, arg);
+
+   pthread_mutex_lock(&cache_lock);
+
+   if (f) {
+      f->pending = 0;
+      f->valid = !err;
+      f->stamp = SerialTimestamp();
+
+      if (!err) snprintf(f->value, STRING_SIZE, "%s", ret);
+   }
+
+   pthread_mutex_unlock(&cache_lock);
+
+   if (!f) CacheInvalidate(dev, cmd);
+
+   return (err);
+}
+
+void
+CacheInvalidate(Device *dev, const char *cmd) {
+   if (dev->protocol != DEVICE_SANYO) return;
+
+   pthread_mutex_lock(&cache_lock);
+
+   if (!strcmp(cmd, "power")) {
+      // power changes make the input unreadable for a while
+      Invalidate(dev, "power");
+      Invalidate(dev, "input");
+   } else if (!strcmp(cmd, "input")) {
+      Invalidate(dev, "input");
+   } else if (cmd[0] == 'C') {
+      // no idea what a generic command does
+      Invalidate(dev, NULL);
+   }
+
+   pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,20 @@
+#ifndef _Z4CTRL_CACHE_H_
+#define _Z4CTRL_CACHE_H_
+
+#include "queue.h"
+
+#define CACHE_POLL_INTERVAL    250 // how often the poller looks for stale fields in ms
+
+#define CACHE_TTL_POWER       2000 // default lifetime of the cached fields in ms
+#define CACHE_TTL_INPUT       5000
+#define CACHE_TTL_LAMP       60000
+#define CACHE_TTL_TEMP       10000
+
+int CacheStart(Queue *queue[]);
+int CacheStop(void);
+
+int CacheRead(Device *dev, char ret[], const char *cmd, const char *arg);
+int CacheExecute(Device *dev, char ret[], const char *cmd, const char *arg);
+void CacheInvalidate(Device *dev, const char *cmd);
+
+#endif // _Z4CTRL_CACHE_H_
@@ -7,6 +7,8 @@
 #define READ_MODEL_NUMBER       "CR5\r"
 #define READ_TEMP_SENSORS       "CR6\r"
 
+#define READ_ALL_STATUS         ""       // never sent, the reads go out one by one
+
 #define POWER_ON                "C00\r"
 #define POWER_OFF_QUICK         "C01\r"
 #define POWER_OFF_ASK           "C02\r"
@@ -78,4 +80,19 @@
 #define KEYSTONE_PLUS           "C8E\r"
 #define KEYSTONE_MINUS          "C8F\r"
 
+// commands understood by the arduino bridge to the onkyo receiver
+
+#define ONKYO_STATUS            "status\n"
+#define ONKYO_POWER             "power\n"
+#define ONKYO_VOLUME_UP         "vol+\n"
+#define ONKYO_VOLUME_DOWN       "vol-\n"
+#define ONKYO_MUTE              "mute\n"
+#define ONKYO_XBOX              "xbox\n"
+#define ONKYO_PS2               "ps2\n"
+#define ONKYO_SPEAKER           "speaker\n"
+#define ONKYO_MOVIE             "movie\n"
+#define ONKYO_GAME              "game\n"
+#define ONKYO_MUSIC             "music\n"
+#define ONKYO_STEREO            "stereo\n"
+
 #endif // _Z4CTRL_COMMAND_H_
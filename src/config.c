@@ -0,0 +1,34 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "config.h"
+
+const char *
+ConfigString(const char *key, const char *def) {
+   char name[64];
+   const char *value;
+
+   snprintf(name, sizeof (name), "%s%s", CONFIG_PREFIX, key);
+
+   if ((value = getenv(name)) && (*value)) {
+      return (value);
+   }
+
+   return (def);
+}
+
+int
+ConfigInteger(const char *key, int def) {
+   const char *value = ConfigString(key, NULL);
+   char *end;
+   long num;
+
+   if (!value) return (def);
+
+   num = strtol(value, &end, 0);
+
+   // ignore garbage, fall back to the default
+   if (*end) return (def);
+
+   return ((int)num);
+}
@@ -0,0 +1,9 @@
+#ifndef _Z4CTRL_CONFIG_H_
+#define _Z4CTRL_CONFIG_H_
+
+#define CONFIG_PREFIX "Z4CTRL_" // tunables are read from the environment
+
+const char *ConfigString(const char *key, const char *def);
+int ConfigInteger(const char *key, int def);
+
+#endif // _Z4CTRL_CONFIG_H_
@@ -0,0 +1,268 @@
+#include <pthread.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "config.h"
+#include "sanyo.h"
+#include "onkyo.h"
+#include "device.h"
+
+#define DEVICE_INITIALIZER { "", -1, NULL, "", 0, 0, 0, -1, { NULL }, { 0 }, { { { 0 } } }, \
+                            { 0 }, PTHREAD_MUTEX_INITIALIZER }
+
+// slots are never freed, a replugged device gets its old slot back
+static Device device[DEVICE_MAX] = {
+   DEVICE_INITIALIZER, DEVICE_INITIALIZER, DEVICE_INITIALIZER, DEVICE_INITIALIZER,
+   DEVICE_INITIALIZER, DEVICE_INITIALIZER, DEVICE_INITIALIZER, DEVICE_INITIALIZER
+};
+
+// serializes slot assignment, transactions only need the device lock
+static pthread_mutex_t slot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+Device *
+DeviceSlot(unsigned int index) {
+   return ((index < DEVICE_MAX) ? &device[index] : NULL);
+}
+
+unsigned int
+DeviceIndex(const Device *dev) {
+   return (dev - device);
+}
+
+Device *
+DeviceFind(const char *name) {
+   for (int i=0; i<DEVICE_MAX; i++) {
+      if ((device[i].protocol >= 0) && !strcmp(device[i].name, name)) return (&device[i]);
+   }
+
+   return (NULL);
+}
+
+Device *
+DeviceDefault(int protocol) {
+   Device *first = NULL;
+   int attached;
+
+   // the first attached device of a kind is addressed without a name
+   for (int i=0; i<DEVICE_MAX; i++) {
+      if (device[i].protocol != protocol) continue;
+
+      pthread_mutex_lock(&device[i].lock);
+      attached = (device[i].serial != NULL);
+      pthread_mutex_unlock(&device[i].lock);
+
+      if (attached) return (&device[i]);
+
+      if (!first) first = &device[i];
+   }
+
+   return (first);
+}
+
+static Device *
+FindSlot(int protocol, const char *path) {
+   Device *free_slot = NULL, *detached = NULL;
+   int index = 0;
+
+   for (int i=0; i<DEVICE_MAX; i++) {
+      if (device[i].protocol < 0) {
+         if (!free_slot) free_slot = &device[i];
+         continue;
+      }
+
+      if (device[i].protocol != protocol) continue;
+
+      index++;
+
+      if (device[i].serial) continue;
+
+      // same port as before, the device keeps its name
+      if (*path && !strcmp(device[i].path, path)) return (&device[i]);
+
+      if (!detached) detached = &device[i];
+   }
+
+   // probably the same device on another port
+   if (detached) return (detached);
+
+   if (free_slot) {
+      free_slot->protocol = protocol;
+      free_slot->timeout = (protocol == DEVICE_SANYO) ? SANYO_TIMEOUT : ONKYO_TIMEOUT;
+      free_slot->timeout = ConfigInteger("TIMEOUT_CEILING", free_slot->timeout);
+      free_slot->timeout_floor = ConfigInteger("TIMEOUT_FLOOR", DEVICE_TIMEOUT_FLOOR);
+      free_slot->breaker.threshold = ConfigInteger("BREAKER_FAILURES", DEVICE_BREAKER_FAILURES);
+      free_slot->breaker.interval = ConfigInteger("BREAKER_PROBE", DEVICE_BREAKER_PROBE);
+
+      snprintf(free_slot->name, DEVICE_NAME_SIZE, "%s%i",
+               (protocol == DEVICE_SANYO) ? "sanyo" : "onkyo", index);
+   }
+
+   return (free_slot);
+}
+
+Device *
+DeviceAttach(int protocol, Serial *serial) {
+   char path[DEVICE_PATH_SIZE] = "";
+   Device *dev;
+
+   SerialLookupPath(serial->device, path, sizeof (path));
+
+   pthread_mutex_lock(&slot_lock);
+
+   if ((dev = FindSlot(protocol, path))) {
+      pthread_mutex_lock(&dev->lock);
+
+      if (dev->serial) {
+         // slot taken by a device on another port, should not happen
+         pthread_mutex_unlock(&dev->lock);
+         dev = NULL;
+      } else {
+         dev->serial = serial;
+         dev->owed = 0;
+         dev->power = SANYO_POWER_UNKNOWN;
+         memset(dev->setting, 0, sizeof (dev->setting));
+         strcpy(dev->path, path);
+         memset(&dev->stats, 0, sizeof (DeviceStats));
+         memset(dev->rtt, 0, sizeof (dev->rtt));
+         dev->breaker.failures = 0;
+         pthread_mutex_unlock(&dev->lock);
+      }
+   }
+
+   pthread_mutex_unlock(&slot_lock);
+
+   return (dev);
+}
+
+void
+DeviceDetach(Device *dev) {
+   pthread_mutex_lock(&dev->lock);
+
+   if (dev->serial) {
+      SerialClose(dev->serial);
+      dev->serial = NULL;
+   }
+
+   pthread_mutex_unlock(&dev->lock);
+}
+
+void
+DeviceDetachAll(void) {
+   for (int i=0; i<DEVICE_MAX; i++) {
+      if (device[i].protocol >= 0) DeviceDetach(&device[i]);
+   }
+}
+
+int
+DeviceIsAttached(const char *node) {
+   int attached = 0;
+
+   for (int i=0; (i<DEVICE_MAX) && !attached; i++) {
+      pthread_mutex_lock(&device[i].lock);
+      attached = (device[i].serial && !strcmp(device[i].serial->device, node));
+      pthread_mutex_unlock(&device[i].lock);
+   }
+
+   return (attached);
+}
+
+static void
+Learn(Device *dev, DeviceRtt *rtt, long ms) {
+   unsigned short sorted[DEVICE_RTT_SAMPLES], sample;
+   unsigned int n, j;
+   long timeout;
+
+   rtt->sample[rtt->count++ % DEVICE_RTT_SAMPLES] = (ms < 0xffff) ? ms : 0xffff;
+
+   if (rtt->count < DEVICE_RTT_MIN_SAMPLES) return;
+
+   n = (rtt->count < DEVICE_RTT_SAMPLES) ? rtt->count : DEVICE_RTT_SAMPLES;
+
+   // insertion sort, a few dozen samples cost nothing next to a serial round trip
+   for (int i=0; i<n; i++) {
+      sample = rtt->sample[i];
+
+      for (j=i; (j > 0) && (sorted[j-1] > sample); j--) sorted[j] = sorted[j-1];
+
+      sorted[j] = sample;
+   }
+
+   j = (n * DEVICE_RTT_PERCENTILE) / 100;
+
+   timeout = sorted[(j < n) ? j : n - 1] * DEVICE_RTT_MARGIN;
+
+   if (timeout < dev->timeout_floor) timeout = dev->timeout_floor;
+   if (timeout > dev->timeout) timeout = dev->timeout;
+
+   rtt->timeout = timeout;
+}
+
+int
+DeviceTimeout(const Device *dev, int class) {
+   const DeviceRtt *rtt;
+   long timeout;
+
+   if ((class < 0) || (class >= DEVICE_CLASSES)) return (dev->timeout);
+
+   rtt = &dev->rtt[class];
+
+   // nothing learned yet, give the device all the time it may need
+   if (!rtt->timeout) return (dev->timeout);
+
+   // a device that got slower must be able to prove it
+   timeout = (long)rtt->timeout << rtt->misses;
+
+   return ((timeout < dev->timeout) ? timeout : dev->timeout);
+}
+
+int
+DeviceBreakerState(Device *dev) {
+   DeviceBreaker *breaker = &dev->breaker;
+   long now;
+
+   if (!breaker->threshold || (breaker->failures < breaker->threshold)) {
+      return (DEVICE_BREAKER_CLOSED);
+   }
+
+   now = SerialTimestamp();
+
+   if (now - breaker->tripped < breaker->interval) return (DEVICE_BREAKER_OPEN);
+
+   // one probe per interval, the callers after it fail fast again
+   breaker->tripped = now;
+
+   return (DEVICE_BREAKER_HALF_OPEN);
+}
+
+void
+DeviceCountCommand(Device *dev, int class, long start, int err) {
+   DeviceRtt *rtt = ((class >= 0) && (class < DEVICE_CLASSES)) ? &dev->rtt[class] : NULL;
+
+   dev->stats.commands++;
+   dev->stats.round_trip = SerialTimestamp() - start;
+
+   if (err) dev->stats.errors++;
+   if (err == READ_TIMEOUT) dev->stats.timeouts++;
+
+   if ((err == READ_TIMEOUT) || (err == WRITE_ERROR)) {
+      if (++dev->breaker.failures == dev->breaker.threshold) {
+         dev->breaker.tripped = SerialTimestamp();
+      }
+   } else if (!err || (err == UNKNOWN_COMMAND)) {
+      dev->breaker.failures = 0;
+   }
+
+   if (!rtt) return;
+
+   if (err == READ_TIMEOUT) {
+      if (rtt->misses < DEVICE_RTT_BACKOFF) rtt->misses++;
+      return;
+   }
+
+   // '?' is an answer as well, anything else never reached the device
+   if (err && (err != UNKNOWN_COMMAND)) return;
+
+   rtt->misses = 0;
+
+   Learn(dev, rtt, dev->stats.round_trip);
+}
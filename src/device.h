@@ -0,0 +1,93 @@
+#ifndef _Z4CTRL_DEVICE_H_
+#define _Z4CTRL_DEVICE_H_
+
+#include <pthread.h>
+
+#include "registry.h"
+#include "serial.h"
+
+#define DEVICE_MAX               8 // max number of devices per process
+#define DEVICE_NAME_SIZE        16
+#define DEVICE_PATH_SIZE       256 // by-path entries are file names
+
+#define DEVICE_RTT_SAMPLES      64 // recent round trips kept per command class
+#define DEVICE_RTT_MIN_SAMPLES  16 // until then the ceiling applies
+#define DEVICE_RTT_PERCENTILE   99 // timeouts are derived from this percentile
+#define DEVICE_RTT_MARGIN        2 // ... times this factor
+#define DEVICE_RTT_BACKOFF       5 // max number of doublings after timeouts in a row
+
+#define DEVICE_TIMEOUT_FLOOR   100 // shortest timeout ever used in ms
+
+#define DEVICE_BREAKER_FAILURES  3 // timeouts in a row that open the breaker
+#define DEVICE_BREAKER_PROBE  5000 // time between probes of an open breaker in ms
+
+// commands of a class take about the same time on the device
+enum {
+   DEVICE_CLASS_READ,                 // status queries
+   DEVICE_CLASS_SET,                  // mode changes and button presses
+   DEVICE_CLASS_POWER,                // power on and off
+   DEVICE_CLASSES
+};
+
+enum {
+   DEVICE_BREAKER_CLOSED,             // commands go through
+   DEVICE_BREAKER_OPEN,               // commands fail right away
+   DEVICE_BREAKER_HALF_OPEN           // the caller has to probe the device first
+};
+
+typedef struct DeviceStats {
+   unsigned long commands;            ///< transactions started
+   unsigned long errors;              ///< transactions that failed
+   unsigned long timeouts;            ///< transactions without a response
+   long round_trip;                   ///< duration of the last transaction in ms
+   unsigned long elided;              ///< commands answered from the state model
+   unsigned long stale;               ///< late or implausible responses dropped
+   unsigned long rejected;            ///< commands failed fast by the open breaker
+} DeviceStats;
+
+typedef struct DeviceRtt {
+   unsigned short sample[DEVICE_RTT_SAMPLES]; ///< round trips in ms, oldest overwritten first
+   unsigned int count;                ///< samples taken so far
+   unsigned int misses;               ///< timeouts in a row, each one doubles the timeout
+   int timeout;                       ///< learned timeout in ms, 0 until enough samples
+} DeviceRtt;
+
+typedef struct DeviceBreaker {
+   unsigned int failures;             ///< timeouts and write errors in a row
+   unsigned int threshold;            ///< failures that open the breaker, 0 disables it
+   int interval;                      ///< time between probes while open in ms
+   long tripped;                      ///< time the breaker opened or was last probed in ms
+} DeviceBreaker;
+
+typedef struct Device {
+   char name[DEVICE_NAME_SIZE];       ///< e.g. "sanyo0", addresses the device
+   int protocol;                      ///< DEVICE_SANYO, DEVICE_ONKYO or -1 if unused
+   Serial *serial;                    ///< NULL while detached
+   char path[DEVICE_PATH_SIZE];       ///< persistent name of the port, if known
+   int timeout;                       ///< longest deadline for a response in ms
+   int timeout_floor;                 ///< shortest deadline for a response in ms
+   unsigned int owed;                 ///< responses still in flight after a timeout
+   int power;                         ///< last known power state of a projector, -1 if unknown
+   const Entry *setting[SETTINGS];    ///< last confirmed command of each setting, NULL if unknown
+   DeviceStats stats;
+   DeviceRtt rtt[DEVICE_CLASSES];     ///< round trip distribution per command class
+   DeviceBreaker breaker;             ///< fails commands fast while the device is silent
+   pthread_mutex_t lock;              ///< held while a transaction is in flight
+} Device;
+
+Device *DeviceSlot(unsigned int index);
+unsigned int DeviceIndex(const Device *dev);
+Device *DeviceFind(const char *name);
+Device *DeviceDefault(int protocol);
+
+Device *DeviceAttach(int protocol, Serial *serial);
+void DeviceDetach(Device *dev);
+void DeviceDetachAll(void);
+
+int DeviceIsAttached(const char *node);
+
+int DeviceTimeout(const Device *dev, int class);
+int DeviceBreakerState(Device *dev);
+void DeviceCountCommand(Device *dev, int class, long start, int err);
+
+#endif // _Z4CTRL_DEVICE_H_
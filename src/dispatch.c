@@ -0,0 +1,185 @@
+#include <string.h>
+#include <stdio.h>
+
+#include "sanyo.h"
+#include "onkyo.h"
+#include "dispatch.h"
+
+static const Entry *
+Lookup(const char *cmd, const char *arg) {
+   const Entry *entry;
+
+   if ((entry = RegistryLookup(cmd, arg))) return (entry);
+
+   // commands without argument ignore whatever is passed along
+   return (RegistryLookup(cmd, ""));
+}
+
+int
+DispatchDevice(const char *cmd, const char *arg) {
+   const Entry *entry;
+   const Group *group;
+
+   if ((entry = Lookup(cmd, arg))) return (entry->device);
+   if ((group = RegistryGroup(cmd))) return (group->device);
+
+   return (DEVICE_SANYO);
+}
+
+int
+DispatchBreaker(Device *dev) {
+   char ret[STRING_SIZE];
+   int err;
+
+   switch (DeviceBreakerState(dev)) {
+      case DEVICE_BREAKER_OPEN:
+         dev->stats.rejected++;
+         return (DEVICE_UNRESPONSIVE);
+
+      case DEVICE_BREAKER_HALF_OPEN:
+         // a cheap status read tells whether the device is back
+         if (dev->protocol == DEVICE_SANYO) {
+            err = ReadPowerStatus(dev, ret);
+         } else {
+            err = OnkyoReadStatus(dev, ret);
+         }
+
+         if (err && (err != UNKNOWN_COMMAND)) return (DEVICE_UNRESPONSIVE);
+      break;
+   }
+
+   return (0);
+}
+
+int
+DispatchCommand(Device *dev, char ret[], const char *cmd, const char *arg) {
+   const Entry *entry;
+   int err;
+
+   if ((entry = Lookup(cmd, arg))) {
+      // e.g. a projector command sent to a receiver
+      if (entry->device != dev->protocol) return (INVALID_ARGUMENT);
+
+      if ((err = DispatchBreaker(dev))) return (err);
+
+      if (entry->device == DEVICE_ONKYO) {
+         return (OnkyoSendCommand(dev, ret, entry->wire));
+      }
+
+      err = SanyoSendCommand(dev, ret, entry->wire, entry->reply);
+      DispatchTrack(dev, cmd, arg, err);
+
+      return (err);
+   }
+
+   if ((cmd[0] == 'C') && (dev->protocol == DEVICE_SANYO)) {
+      if ((err = DispatchBreaker(dev))) return (err);
+
+      err = ExecGenericCommand(dev, ret, cmd);
+      DispatchTrack(dev, cmd, arg, err);
+
+      return (err);
+   }
+
+   return ((RegistryGroup(cmd)) ? INVALID_ARGUMENT : UNKNOWN_COMMAND);
+}
+
+int
+DispatchWire(Device *dev, const char *cmd, const char *arg, char wire[], int *reply) {
+   const Entry *entry;
+
+   if ((entry = Lookup(cmd, arg))) {
+      // only single projector commands can be split into write and read
+      if ((entry->device != DEVICE_SANYO) || (dev->protocol != DEVICE_SANYO) ||
+          (entry->reply == REPLY_ALL)) {
+         return (INVALID_ARGUMENT);
+      }
+
+      snprintf(wire, STRING_SIZE, "%s", entry->wire);
+      *reply = entry->reply;
+
+      return (0);
+   }
+
+   if ((cmd[0] == 'C') && (dev->protocol == DEVICE_SANYO)) {
+      snprintf(wire, 5, "%3s\r", cmd);
+      *reply = REPLY_TEXT;
+
+      return (0);
+   }
+
+   return ((RegistryGroup(cmd)) ? INVALID_ARGUMENT : UNKNOWN_COMMAND);
+}
+
+int
+DispatchIsQuery(const char *cmd, const char *arg) {
+   const Entry *entry;
+
+   // status reads of both devices, everything else makes a device do something
+   if ((entry = Lookup(cmd, arg))) return ((entry->flags & ENTRY_READ) != 0);
+
+   // generic CR? commands are reads as well
+   return (!strncmp(cmd, "CR", 2));
+}
+
+int
+DispatchSetting(const char *cmd, const char *arg) {
+   const Group *group;
+
+   if (!Lookup(cmd, arg) || !(group = RegistryGroup(cmd))) return (SETTING_NONE);
+
+   return (group->setting);
+}
+
+int
+DispatchIsRepeatable(const char *cmd, const char *arg) {
+   const Entry *entry;
+
+   // button presses, but never reads, power, menu or logo commands
+   if (!(entry = Lookup(cmd, arg))) return (0);
+
+   return ((entry->flags & ENTRY_REPEAT) != 0);
+}
+
+int
+DispatchMustWait(Device *dev, const char *cmd, const char *arg) {
+   if ((dev->protocol != DEVICE_SANYO) || !SanyoPowerBusy(dev)) return (0);
+
+   // unknown commands fail right away
+   if (!Lookup(cmd, arg) && (cmd[0] != 'C')) return (0);
+
+   // status reads are answered in any power state
+   return (!DispatchIsQuery(cmd, arg));
+}
+
+int
+DispatchIsCurrent(Device *dev, const char *cmd, const char *arg) {
+   const Entry *entry;
+   const Group *group;
+
+   if (!(entry = Lookup(cmd, arg)) || (entry->device != dev->protocol)) return (0);
+
+   if (!(group = RegistryGroup(cmd)) || (group->setting == SETTING_NONE)) return (0);
+
+   return (dev->setting[group->setting] == entry);
+}
+
+void
+DispatchTrack(Device *dev, const char *cmd, const char *arg, int err) {
+   const Entry *entry = Lookup(cmd, arg);
+   const Group *group;
+
+   if (dev->protocol != DEVICE_SANYO) return;
+
+   // status reads change nothing, typos never reach the projector
+   if ((!entry && (cmd[0] != 'C')) || DispatchIsQuery(cmd, arg)) return;
+
+   if (entry && (group = RegistryGroup(cmd)) && (group->setting != SETTING_NONE)) {
+      // without an acknowledge the setting is unknown
+      dev->setting[group->setting] = (err) ? NULL : entry;
+      return;
+   }
+
+   // power, menu navigation and generic commands may change anything
+   memset(dev->setting, 0, sizeof (dev->setting));
+}
@@ -0,0 +1,21 @@
+#ifndef _Z4CTRL_DISPATCH_H_
+#define _Z4CTRL_DISPATCH_H_
+
+#include "registry.h"
+#include "device.h"
+
+int DispatchDevice(const char *cmd, const char *arg);
+
+// fails fast while the device does not answer, probes it now and then
+int DispatchBreaker(Device *dev);
+int DispatchCommand(Device *dev, char ret[], const char *cmd, const char *arg);
+int DispatchWire(Device *dev, const char *cmd, const char *arg, char wire[], int *reply);
+int DispatchIsQuery(const char *cmd, const char *arg);
+int DispatchSetting(const char *cmd, const char *arg);
+int DispatchIsRepeatable(const char *cmd, const char *arg);
+int DispatchMustWait(Device *dev, const char *cmd, const char *arg);
+
+int DispatchIsCurrent(Device *dev, const char *cmd, const char *arg);
+void DispatchTrack(Device *dev, const char *cmd, const char *arg, int err);
+
+#endif // _Z4CTRL_DISPATCH_H_
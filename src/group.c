@@ -0,0 +1,182 @@
+#define _POSIX_C_SOURCE 199309L // clock_gettime()
+
+#include <pthread.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "dispatch.h"
+#include "config.h"
+#include "serial.h"
+#include "sanyo.h"
+#include "transaction.h"
+#include "group.h"
+
+static long
+Microseconds(void) {
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   return (now.tv_sec * 1000000 + now.tv_nsec / 1000);
+}
+
+static int
+ParseGroup(const char *groups, const char *name, int selected[]) {
+   const char *ptr = groups;
+   char member[DEVICE_NAME_SIZE];
+   size_t len;
+   Device *dev;
+
+   // "wall=sanyo0,sanyo1 side=sanyo2,sanyo3"
+   while (*(ptr += strspn(ptr, " \t"))) {
+      len = strcspn(ptr, "=");
+
+      if (!ptr[len]) return (0);
+
+      if ((len != strlen(name)) || strncmp(ptr, name, len)) {
+         ptr += strcspn(ptr, " \t");
+         continue;
+      }
+
+      ptr += len + 1;
+
+      while (*ptr && !strchr(" \t", *ptr)) {
+         len = strcspn(ptr, ", \t");
+
+         if (len && (len < DEVICE_NAME_SIZE)) {
+            memcpy(member, ptr, len);
+            member[len] = '\0';
+
+            // devices that were never seen are skipped
+            if ((dev = DeviceFind(member))) selected[DeviceIndex(dev)] = 1;
+         }
+
+         ptr += len;
+         if (*ptr == ',') ptr++;
+      }
+
+      return (1);
+   }
+
+   return (0);
+}
+
+int
+GroupFind(const char *name, Device *member[], unsigned int *count) {
+   int selected[DEVICE_MAX] = { 0 };
+   Device *dev;
+
+   if (!strcmp(name, GROUP_ALL)) {
+      for (int i=0; i<DEVICE_MAX; i++) {
+         selected[i] = (DeviceSlot(i)->protocol == DEVICE_SANYO);
+      }
+   } else if (!ParseGroup(ConfigString("GROUPS", ""), name, selected)) {
+      return (NOT_CONNECTED);
+   }
+
+   *count = 0;
+
+   // members are kept in slot order, which is also the locking order
+   for (int i=0; i<DEVICE_MAX; i++) {
+      if (!selected[i]) continue;
+
+      dev = DeviceSlot(i);
+
+      if (dev->protocol != DEVICE_SANYO) return (INVALID_ARGUMENT);
+
+      member[(*count)++] = dev;
+   }
+
+   return ((*count) ? 0 : NOT_CONNECTED);
+}
+
+static int
+IsCurrent(Device *member[], unsigned int count, const char *cmd, const char *arg) {
+   for (int i=0; i<count; i++) {
+      if (!DispatchIsCurrent(member[i], cmd, arg)) return (0);
+   }
+
+   return (1);
+}
+
+int
+GroupExecute(Device *member[], unsigned int count, const char *cmd,
+             const char *arg, int force, GroupResult *result) {
+   long start[DEVICE_MAX], first = 0, last = 0;
+   char wire[STRING_SIZE];
+   int err, reply, elided;
+
+   memset(result, 0, sizeof (GroupResult));
+
+   // everything is prepared up front, nothing but the writes sit in between
+   if ((err = DispatchWire(member[0], cmd, arg, wire, &reply))) {
+      return (err);
+   }
+
+   for (int i=0; i<count; i++) {
+      pthread_mutex_lock(&member[i]->lock);
+
+      // checked under the lock, no other executor can power a member up in between
+      result->waiting |= DispatchMustWait(member[i], cmd, arg);
+   }
+
+   // all members have to be ready, or the writes would not be synchronized
+   if (result->waiting) {
+      for (int i=count; i>0; i--) {
+         pthread_mutex_unlock(&member[i-1]->lock);
+      }
+
+      return (0);
+   }
+
+   // stale input is dropped here, not between the writes
+   for (int i=0; i<count; i++) {
+      TransactionBegin(member[i]);
+   }
+
+   // a wall only stays in sync if all members get the command or none
+   if ((elided = (!force && IsCurrent(member, count, cmd, arg)))) {
+      for (int i=0; i<count; i++) {
+         strcpy(result->ret[i], "!");
+         member[i]->stats.elided++;
+      }
+   }
+
+   // a silent member must not hold up the others, nor split their writes
+   for (int i=0; (i<count) && !elided; i++) {
+      result->err[i] = DispatchBreaker(member[i]);
+   }
+
+   for (int i=0; (i<count) && !elided; i++) {
+      if (result->err[i]) continue;
+
+      last = Microseconds();
+      if (!first) first = last;
+
+      result->err[i] = SanyoWriteCommand(member[i], wire);
+      start[i] = last / 1000;
+   }
+
+   // the projectors answer concurrently, so this takes as long as the slowest
+   for (int i=0; (i<count) && !elided; i++) {
+      if (!result->err[i]) {
+         result->err[i] = SanyoReadReply(member[i], result->ret[i], wire, reply, start[i]);
+      }
+
+      DispatchTrack(member[i], cmd, arg, result->err[i]);
+   }
+
+   for (int i=count; i>0; i--) {
+      pthread_mutex_unlock(&member[i-1]->lock);
+   }
+
+   result->gap = last - first;
+   result->written = count;
+
+   for (int i=0; i<count; i++) {
+      if (result->err[i]) return (result->err[i]);
+   }
+
+   return (0);
+}
@@ -0,0 +1,21 @@
+#ifndef _Z4CTRL_GROUP_H_
+#define _Z4CTRL_GROUP_H_
+
+#include "sanyo.h"
+#include "device.h"
+
+#define GROUP_ALL            "all" // implicit group of every attached projector
+
+typedef struct GroupResult {
+   char ret[DEVICE_MAX][STRING_SIZE]; ///< response of each member
+   int err[DEVICE_MAX];               ///< error of each member
+   unsigned int written;              ///< members the command went out to, 0 if it was rejected
+   int waiting;                       ///< a member warms up or cools down, nothing was written
+   long gap;                          ///< time between first and last write in us
+} GroupResult;
+
+int GroupFind(const char *name, Device *member[], unsigned int *count);
+int GroupExecute(Device *member[], unsigned int count, const char *cmd,
+                 const char *arg, int force, GroupResult *result);
+
+#endif // _Z4CTRL_GROUP_H_
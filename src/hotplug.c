@@ -0,0 +1,231 @@
+#define _DEFAULT_SOURCE // realpath()
+
+#include <sys/inotify.h>
+#include <pthread.h>
+#include <string.h>
+#include <syslog.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "config.h"
+#include "serial.h"
+#include "sanyo.h"
+#include "onkyo.h"
+#include "probe.h"
+#include "device.h"
+#include "hotplug.h"
+
+#define HOTPLUG_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM)
+
+static pthread_t hotplug_tid;
+static int stop_pipe[2] = { -1, -1 };
+
+static int by_path_wd     = -1;
+static int parent_wd      = -1;
+static int grandparent_wd = -1;
+
+// directories to watch while by-path does not exist
+static char parent_dir[PATH_MAX];
+static char grandparent_dir[PATH_MAX];
+
+static void
+Configure(Device *dev) {
+   long before, after;
+
+   pthread_mutex_lock(&dev->lock);
+
+   if (dev->protocol == DEVICE_ONKYO) {
+      OnkyoSetBaudrate(dev, ConfigInteger("ONKYO_BAUD", ONKYO_BAUD));
+   }
+
+   if (ConfigInteger("LOW_LATENCY", 0) && !ProbeLowLatency(dev, &before, &after)) {
+      syslog(LOG_INFO, "round trip on %s %.1f ms -> %.1f ms", dev->name,
+             before / 1000.0, after / 1000.0);
+   }
+
+   pthread_mutex_unlock(&dev->lock);
+}
+
+static void
+DeviceAdded(const char *name) {
+   char link[PATH_MAX], *node;
+   Device *dev;
+
+   snprintf(link, sizeof (link), "%s/%s", SerialDirectory(), name);
+
+   if (!(node = realpath(link, NULL))) {
+      return;
+   }
+
+   // only ports that are not in use yet need a probe, which runs without
+   // holding any device lock, so commands keep flowing in the meantime
+   if (!DeviceIsAttached(node) && !ProbeDevices(&node, 1, &dev)) {
+      syslog(LOG_INFO, "%s %s attached on %s", (dev->protocol == DEVICE_SANYO) ?
+             "Sanyo projector" : "Onkyo receiver", dev->name, node);
+
+      Configure(dev);
+      ProbeSaveCache();
+   }
+
+   free(node);
+}
+
+static void
+DeviceRemoved(const char *name) {
+   Device *dev;
+
+   for (int i=0; i<DEVICE_MAX; i++) {
+      dev = DeviceSlot(i);
+
+      if ((dev->protocol < 0) || strcmp(dev->path, name)) continue;
+
+      pthread_mutex_lock(&dev->lock);
+      if (dev->serial) syslog(LOG_INFO, "%s detached from %s", dev->name, dev->serial->device);
+      pthread_mutex_unlock(&dev->lock);
+
+      DeviceDetach(dev);
+   }
+}
+
+static void
+ArmWatches(int fd) {
+   struct dirent *entry;
+   DIR *dir;
+
+   if (by_path_wd >= 0) return;
+
+   // the by-path directory only exists while at least one port is plugged,
+   // so watch its parents for the directory to appear again
+   if ((by_path_wd = inotify_add_watch(fd, SerialDirectory(), HOTPLUG_EVENTS)) < 0) {
+      if (parent_wd < 0) {
+         parent_wd = inotify_add_watch(fd, parent_dir, IN_CREATE | IN_ONLYDIR);
+      }
+      if (grandparent_wd < 0) {
+         grandparent_wd = inotify_add_watch(fd, grandparent_dir, IN_CREATE | IN_ONLYDIR);
+      }
+
+      return;
+   }
+
+   if (parent_wd      >= 0) inotify_rm_watch(fd, parent_wd);
+   if (grandparent_wd >= 0) inotify_rm_watch(fd, grandparent_wd);
+
+   parent_wd = grandparent_wd = -1;
+
+   // links created before the watch was in place would be missed otherwise
+   if ((dir = opendir(SerialDirectory()))) {
+      while ((entry = readdir(dir))) {
+         if (entry->d_name[0] != '.') DeviceAdded(entry->d_name);
+      }
+      closedir(dir);
+   }
+}
+
+static void *
+HotplugThread(void *arg) {
+   char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+   int fd = *(int *)arg, len;
+   struct inotify_event *event;
+   struct pollfd pfd[2];
+
+   pfd[0].fd = fd;
+   pfd[0].events = POLLIN;
+   pfd[1].fd = stop_pipe[0];
+   pfd[1].events = POLLIN;
+
+   ArmWatches(fd);
+
+   while (poll(pfd, 2, -1) != 0) {
+      if (pfd[1].revents) break;
+
+      if (!pfd[0].revents) continue;
+
+      if ((len = read(fd, buffer, sizeof (buffer))) <= 0) {
+         if ((len < 0) && (errno == EINTR)) continue;
+
+         break;
+      }
+
+      for (char *ptr = buffer; ptr < buffer + len; ptr += sizeof (*event) + event->len) {
+         event = (struct inotify_event *)ptr;
+
+         if (event->mask & IN_IGNORED) {
+            // watched directory is gone, e.g. by-path with the last port
+            if (event->wd == by_path_wd)     by_path_wd     = -1;
+            if (event->wd == parent_wd)      parent_wd      = -1;
+            if (event->wd == grandparent_wd) grandparent_wd = -1;
+            continue;
+         }
+
+         if (event->wd != by_path_wd) {
+            // some parent directory changed, maybe by-path is back
+            continue;
+         }
+
+         if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+            DeviceAdded(event->name);
+         } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+            DeviceRemoved(event->name);
+         }
+      }
+
+      ArmWatches(fd);
+   }
+
+   close(fd);
+
+   return (NULL);
+}
+
+int
+HotplugStart(void) {
+   static int fd;
+   char *slash;
+
+   // e.g. /dev/serial and /dev for /dev/serial/by-path
+   snprintf(parent_dir, sizeof (parent_dir), "%s", SerialDirectory());
+   if ((slash = strrchr(parent_dir, '/')) && (slash != parent_dir)) *slash = '\0';
+
+   snprintf(grandparent_dir, sizeof (grandparent_dir), "%s", parent_dir);
+   if ((slash = strrchr(grandparent_dir, '/')) && (slash != grandparent_dir)) *slash = '\0';
+
+   if ((fd = inotify_init()) < 0) {
+      return (OPEN_FAILED);
+   }
+
+   if (pipe(stop_pipe)) {
+      close(fd);
+      return (OPEN_FAILED);
+   }
+
+   if (pthread_create(&hotplug_tid, NULL, HotplugThread, &fd)) {
+      close(stop_pipe[0]);
+      close(stop_pipe[1]);
+      close(fd);
+      return (OPEN_FAILED);
+   }
+
+   return (0);
+}
+
+int
+HotplugStop(void) {
+   if (stop_pipe[1] < 0) return (0);
+
+   // wake up and terminate the watcher thread
+   if (write(stop_pipe[1], "", 1) == 1) {
+      pthread_join(hotplug_tid, NULL);
+   }
+
+   close(stop_pipe[0]);
+   close(stop_pipe[1]);
+
+   stop_pipe[0] = stop_pipe[1] = -1;
+
+   return (0);
+}
@@ -0,0 +1,7 @@
+#ifndef _Z4CTRL_HOTPLUG_H_
+#define _Z4CTRL_HOTPLUG_H_
+
+int HotplugStart(void);
+int HotplugStop(void);
+
+#endif // _Z4CTRL_HOTPLUG_H_
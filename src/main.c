@@ -6,31 +6,30 @@
 #include <stdio.h>
 
 #include "server.h"
+#include "config.h"
 #include "serial.h"
 #include "sanyo.h"
 #include "onkyo.h"
+#include "probe.h"
+#include "dispatch.h"
+#include "queue.h"
 
 static void
 HelpUsage(void) {
    puts("");
    puts("sanyo projector control server " VERSION " <clemens@1541.org>");
    puts("");
-   puts("USAGE: z4ctrl <command> <argument>");
+   puts("USAGE: z4ctrl [@device|@group] <command> <argument>");
    puts("");
    puts("POSSIBLE COMMANDS:");
    puts("");
    puts("\tC??    ... send generic 3 byte command to the projector");
-   puts("\tstatus ... read current status from projector");
-   puts("\tpower  ... power the projector on or off");
-   puts("\tinput  ... select video source");
-   puts("\tscaler ... set image scaler mode");
-   puts("\tlamp   ... set lamp brightness");
-   puts("\tcolor  ... set color mode");
-   puts("\tmute   ... mute picture");
-   puts("\tlogo   ... select startup logo");
-   puts("\tmenu   ... switch OSD menu on or off");
-   puts("\tpress  ... emulate menu navigation buttons");
-   puts("\tmodel  ... read model number");
+
+   for (int i=0; i<registry_groups; i++) {
+      printf("\t%-6s ... %s\n", registry_group[i].command, registry_group[i].summary);
+   }
+
+   puts("\tbatch  ... run several commands separated by ';' back-to-back");
    puts("\tprobe  ... probe serial devices for connected devices and exit");
    puts("\tserver ... fork to background and keep running as network service");
    puts("");
@@ -43,167 +42,51 @@ HelpUsage(void) {
    puts("\t4      ... serial write error");
    puts("\t5      ... serial read timeout");
    puts("\t6      ... no projector connected");
+   puts("\t7      ... device busy");
+   puts("\t8      ... device not responding");
    puts("");
 
    exit(0);
 }
 
 static void
-HelpStatusRead(void) {
-   puts("possible status read arguments are:");
-   puts("");
-   puts("\tpower    ... return current power status");
-   puts("\tinput    ... return selected video input");
-   puts("\tlamp     ... return houres of lamp use");
-   puts("\ttemp     ... return current temperaure sensor values");
-   puts("");
-
-   exit(0);
-}
-
-static void
-HelpLampMode(void) {
-   puts("possible lamp modes are:");
-   puts("");
-   puts("\tnormal   ... standard brightness");
-   puts("\tauto1    ... adjusting brightness to input signal");
-   puts("\tauto2    ... like auto1 but less bright");
-   puts("\teco      ... lowest brightness and power consumption");
-   puts("");
-
-   exit(0);
-}
-
-static void
-HelpPowerOnOff(void) {
-   puts("possible power arguments are:");
-   puts("");
-   puts("\ton       ... switch projector on");
-   puts("\toff      ... switch projector to stand-by");
-   puts("\task      ... ask for confirmation before switching off");
+HelpArguments(const Group *group) {
+   puts(group->title);
    puts("");
 
-   exit(0);
-}
+   for (int i=0; i<registry_size; i++) {
+      if (strcmp(registry[i].command, group->command)) continue;
 
-static void
-HelpInputSource(void) {
-   puts("possible input sources are:");
-   puts("");
-   puts("\tvideo    ... composit video");
-   puts("\ts-video  ... super video");
-   puts("\tcomp1    ... component video 1");
-   puts("\tcomp2    ... component video 2");
-   puts("\tvga      ... vga video");
-   puts("\thdmi     ... digital hd video");
-   puts("");
-
-   exit(0);
-}
-
-static void
-HelpScalerMode(void) {
-   puts("possible image scaler modes are:");
-   puts("");
-   puts("\toff      ... scaler off");
-   puts("\tnormal   ... scale up 4:3 to 19:9 by adding black borders");
-   puts("\tzoom     ... scale up 4:3 to 19:9 by cutting edges");
-   puts("\tfull     ... strech 4:3 to 19:9 full screen");
-   puts("\tstrech   ... strech 4:3 to 16:9 unscaled");
-   puts("\twide1    ... strech 4:3 to 19:9 but keep aspect ratio in the center");
-   puts("\twide2    ... strech 16:9 with black borders to 16:9 without");
-   puts("\tcaption  ... keep subtitles on the bottom visible");
-   puts("");
-
-   exit(0);
-}
+      printf("\t%-8s ... %s\n", registry[i].argument, registry[i].help);
+   }
 
-static void
-HelpColorMode(void) {
-   puts("possible color modes are:");
-   puts("");
-   puts("\tcreative ... contrasty 3D images in a dark room");
-   puts("\tcinema   ... quiet tones of color in a dark room");
-   puts("\tnatural  ... color correction off");
-   puts("\tliving   ... sport and TV in a bright room");
-   puts("\tdynamic  ... contrasty images in a bright room");
-   puts("\tpowerful ... big screen in a bright room");
-   puts("\tvivid    ... contrasty images to maximum extent");
-   puts("\tuser1    ... user preset 1");
-   puts("\tuser2    ... user preset 2");
-   puts("\tuser3    ... user preset 3");
-   puts("\tuser4    ... user preset 4");
    puts("");
 
    exit(0);
 }
 
 static void
-HelpOsdMenu(void) {
-   puts("possible menu commands are:");
-   puts("");
-   puts("\ton       ... display OSD menu");
-   puts("\toff      ... close OSD menu");
-   puts("\tclear    ... unconditionally clear OSD");
-   puts("");
+LowLatencyMode(const char *name, Device *dev) {
+   long before = 0, after = 0;
 
-   exit(0);
-}
-
-static void
-HelpStartLogo(void) {
-   puts("possible logo commands are:");
-   puts("");
-   puts("\toff      ... don't show any logo at startup");
-   puts("\tdefault  ... use default startup logo");
-   puts("\tuser     ... show captured logo at startup");
-   puts("\tcapture  ... capture current image as startup logo");
-   puts("");
+   switch (ProbeLowLatency(dev, &before, &after)) {
+      case 0:
+         printf("%s round trip %.1f ms -> %.1f ms\n", name, before / 1000.0, after / 1000.0);
+      break;
 
-   exit(0);
+      case OPEN_FAILED:
+         printf("%s round trip %.1f ms, low latency mode not supported\n", name, before / 1000.0);
+      break;
+   }
 }
 
 static void
-HelpButtonPress(void) {
-   puts("possible press commands are:");
+HelpBatch(void) {
+   puts("a batch runs up to 8 commands of one device in a row, e.g.:");
    puts("");
-   puts("\tright    ... move pointer of OSD menu to the right");
-   puts("\tleft     ... move pointer of OSD to the left");
-   puts("\tup       ... move up OSD pointer");
-   puts("\tdown     ... move pointer down");
-   puts("\tenter    ... select highlighted OSD item");
-   puts("");
-
-   exit(0);
-}
-
-static void
-HelpVideoMute(void) {
-   puts("possible mute commands are:");
+   puts("\tz4ctrl batch \"power on; input hdmi; color cinema\"");
    puts("");
-   puts("\ton       ... black out the image");
-   puts("\toff      ... restore image");
-   puts("");
-
-   exit(0);
-}
-
-static void
-HelpOnkyoCommands(void) {
-   puts("possible onkyo commands are:");
-   puts("");
-   puts("\tpower    ... switch receiver on or off");
-   puts("\tmute     ... mute speaker");
-   puts("\tvol+     ... volume up");
-   puts("\tvol-     ... volume down");
-   puts("\txbox     ... select xbmc as audio/video source");
-   puts("\tps2      ... select playstation as audio source");
-   puts("\tspeaker  ... rotate speaker outputs: a -> a/b -> b -> none");
-   puts("\tmovie    ... select audio precessor for movies");
-   puts("\tgame     ... select audio program for games");
-   puts("\tmusic    ... select audio processing for music");
-   puts("\tstereo   ... select stereo program");
-   puts("\tstatus   ... test if Arduino is responding");
+   puts("execution stops at the first failing command.");
    puts("");
 
    exit(0);
@@ -211,45 +94,95 @@ HelpOnkyoCommands(void) {
 
 int
 main(int argc, char **argv) {
-   char ret[STRING_SIZE];
-   int err = UNKNOWN_COMMAND;
+   char ret[BATCH_RESULT_SIZE];
+   const Group *group;
+   Request req;
+   int err = UNKNOWN_COMMAND, parsed = 0, cached = 0;
    unsigned int dev_number = 32;
-   char *dev_node[32];
+   char *dev_node[32], *target = NULL;
+   Device *dev, *found[32];
+   int onkyo_baud = ConfigInteger("ONKYO_BAUD", ONKYO_BAUD);
+
+   // "@sanyo1" in front of the command selects one of several devices
+   if ((argc > 1) && (argv[1][0] == '@')) {
+      target = argv[1] + 1;
+      argv++;
+      argc--;
+   }
 
    if ((argc == 1) || ((argc == 2) && (!strcmp(argv[1], "help")))) {
       HelpUsage();
    }
 
    if ((argc > 2) && (!strcmp(argv[1], "help"))) {
-      if (!strcmp(argv[2], "status")) HelpStatusRead();
-      if (!strcmp(argv[2],  "power")) HelpPowerOnOff();
-      if (!strcmp(argv[2],  "input")) HelpInputSource();
-      if (!strcmp(argv[2], "scaler")) HelpScalerMode();
-      if (!strcmp(argv[2],   "lamp")) HelpLampMode();
-      if (!strcmp(argv[2],  "color")) HelpColorMode();
-      if (!strcmp(argv[2],   "mute")) HelpVideoMute();
-      if (!strcmp(argv[2],   "logo")) HelpStartLogo();
-      if (!strcmp(argv[2],   "menu")) HelpOsdMenu();
-      if (!strcmp(argv[2],  "press")) HelpButtonPress();
-      if (!strcmp(argv[2],  "onkyo")) HelpOnkyoCommands();
+      if ((group = RegistryGroup(argv[2])) && group->title) HelpArguments(group);
+      if (!strcmp(argv[2],  "batch")) HelpBatch();
+   }
+
+   if ((group = RegistryGroup(argv[1])) && group->title) {
+      if ((argc<3) || (!strcmp(argv[2], "help"))) {
+         HelpArguments(group);
+      }
    }
 
-   SerialListDevices(dev_node, &dev_number);
+   memset(&req, 0, sizeof (Request));
 
-   for (int i=0; i<dev_number; i++) {
-      if (!SanyoProbeDevice(dev_node[i])) break;
+   if (!strcmp(argv[1], "batch")) {
+      if ((argc<3) || (!strcmp(argv[2], "help"))) {
+         HelpBatch();
+      }
+
+      parsed = RequestParse(&req, argv[2]);
+   } else {
+      // a single command is a batch of one
+      snprintf(req.command[0].cmd, sizeof (req.command[0].cmd), "%s", argv[1]);
+      snprintf(req.command[0].arg, sizeof (req.command[0].arg), "%s", (argc<3) ? "" : argv[2]);
+      req.command[0].force = ((argc > 3) && !strcmp(argv[3], "force"));
+      req.count = 1;
    }
 
-   for (int i=0; i<dev_number; i++) {
-      if (!OnkyoProbeDevice(dev_node[i])) break;
+   if (target) snprintf(req.target, DEVICE_NAME_SIZE, "%s", target);
+
+   // trust the last probe as long as the device in use still answers there
+   if (!strcmp(argv[1], "server")) {
+      cached = !ProbeLoadCache(NULL, -1);
+   } else if (strcmp(argv[1], "probe")) {
+      cached = !ProbeLoadCache(req.target, DispatchDevice(req.command[0].cmd, req.command[0].arg));
    }
 
-   if (sanyo_serial) {
-      printf("found Sanyo projector on %s\n", sanyo_serial->device);
+   if (!cached) {
+      if (SerialListDevices(dev_node, &dev_number)) {
+         dev_number = 0;
+      }
+
+      // probe all ports concurrently
+      ProbeDevices(dev_node, dev_number, found);
+      ProbeSaveCache();
    }
 
-   if (onkyo_serial) {
-      printf("found Onkyo receiver on %s\n", onkyo_serial->device);
+   for (int i=0; i<DEVICE_MAX; i++) {
+      if (!(dev = DeviceSlot(i))->serial) continue;
+
+      // speed up the arduino bridge, which starts at ONKYO_BAUD after a reset
+      if ((dev->protocol == DEVICE_ONKYO) && (dev->serial->baud != onkyo_baud)) {
+         if (OnkyoSetBaudrate(dev, onkyo_baud)) {
+            printf("could not switch Onkyo receiver to %i baud\n", onkyo_baud);
+         } else {
+            // the bridge keeps the new rate until it is reset
+            ProbeSaveCache();
+         }
+      }
+
+      if (ConfigInteger("LOW_LATENCY", 0)) {
+         LowLatencyMode(dev->name, dev);
+      }
+   }
+
+   for (int i=0; i<DEVICE_MAX; i++) {
+      if (!(dev = DeviceSlot(i))->serial) continue;
+
+      printf("found %s %s on %s\n", (dev->protocol == DEVICE_SANYO) ? "Sanyo projector" :
+             "Onkyo receiver", dev->name, dev->serial->device);
    }
 
    if (!strcmp(argv[1], "probe")) {
@@ -268,100 +201,36 @@ main(int argc, char **argv) {
       exit(0);
    }
 
-   if (argv[1][0] == 'C') {
-      err = ExecGenericCommand(ret, argv[1]);
-   }
-
-   if (!strcmp(argv[1], "model")) {
-      err = ReadModelNumber(ret);
-   }
-
-   if (!strcmp(argv[1], "status")) {
-      if ((argc<3) || (!strcmp(argv[2], "help"))) {
-         HelpStatusRead();
-      } else {
-         err = ExecStatusRead(ret, argv[2]);
-      }
-   }
-
-   if (!strcmp(argv[1], "power")) {
-      if ((argc<3) || (!strcmp(argv[2], "help"))) {
-         HelpPowerOnOff();
-      } else {
-         err = ExecPowerCommand(ret, argv[2]);
-      }
-   }
+   if (!(err = parsed) && !(err = RequestRoute(&req, &dev))) {
+      err = RequestExecute(&req, dev, DispatchCommand);
 
-   if (!strcmp(argv[1], "input")) {
-      if ((argc<3) || (!strcmp(argv[2], "help"))) {
-         HelpInputSource();
-      } else {
-         err = ExecInputCommand(ret, argv[2]);
-      }
-   }
+      // the projector is warming up or cooling down, wait until it is ready
+      while (!err && req.waiting) {
+         if (req.parked) {
+            if (SerialTimestamp() - req.parked >= ConfigInteger("PARK_TIMEOUT", QUEUE_PARK_TIMEOUT)) {
+               err = DEVICE_BUSY;
+               break;
+            }
 
-   if (!strcmp(argv[1], "scaler")) {
-      if ((argc<3) || (!strcmp(argv[2], "help"))) {
-         HelpScalerMode();
-      } else {
-         err = ExecScalerCommand(ret, argv[2]);
-      }   
-   }
+            usleep(QUEUE_PARK_POLL * 1000);
+         }
 
-   if (!strcmp(argv[1], "lamp")) {
-      if ((argc<3) || (!strcmp(argv[2], "help"))) {
-         HelpLampMode();
-      } else {
-         err = ExecLampCommand(ret, argv[2]);
-      }   
-   }
+         // the first poll checks a power state that may only be assumed
+         RequestPoll(&req, dev, DispatchCommand);
 
-   if (!strcmp(argv[1], "color")) {
-      if ((argc<3) || (!strcmp(argv[2], "help"))) {
-         HelpColorMode();
-      } else {
-         err = ExecColorCommand(ret, argv[2]);
-      }   
-   }
-
-   if (!strcmp(argv[1], "mute")) {
-      if ((argc<3) || (!strcmp(argv[2], "help"))) {
-         HelpVideoMute();
-      } else {
-         err = ExecMuteCommand(ret, argv[2]);
-      }   
-   }
+         if ((err = RequestExecute(&req, dev, DispatchCommand)) || !req.waiting) break;
 
-   if (!strcmp(argv[1], "logo")) {
-      if ((argc<3) || (!strcmp(argv[2], "help"))) {
-         HelpStartLogo();
-      } else {
-         err = ExecLogoCommand(ret, argv[2]);
-      }   
-   }
-
-   if (!strcmp(argv[1], "menu")) {
-      if ((argc<3) || (!strcmp(argv[2], "help"))) {
-         HelpOsdMenu();
-      } else {
-         err = ExecMenuCommand(ret, argv[2]);
-      }   
-   }
+         if (!req.parked) {
+            puts("queued, waiting for the projector ...");
+            req.parked = SerialTimestamp();
+         }
+      }
 
-   if (!strcmp(argv[1], "press")) {
-      if ((argc<3) || (!strcmp(argv[2], "help"))) {
-         HelpButtonPress();
-      } else {
-         err = ExecPressCommand(ret, argv[2]);
-      }   
-   }
+      strcpy(ret, req.ret);
 
-   if (!strcmp(argv[1], "onkyo")) {
-      if ((argc<3) || (!strcmp(argv[2], "help"))) {
-         HelpOnkyoCommands();
-      } else {
-         err = OnkyoExecCommand(ret, argv[2]);
-      }   
+      if (err && (req.count > 1)) {
+         printf("batch stopped at command %u of %u\n", req.executed + 1, req.count);
+      }
    }
 
    switch (err) {
@@ -389,6 +258,14 @@ main(int argc, char **argv) {
          printf("device not connected!\n");
       break;
 
+      case DEVICE_BUSY:
+         printf("device busy!\n");
+      break;
+
+      case DEVICE_UNRESPONSIVE:
+         printf("device not responding!\n");
+      break;
+
       default:
          puts(ret);
       break;
@@ -0,0 +1,77 @@
+// build time helper, searches a seed that maps every (command, argument)
+// pair of registry.def to its own slot and prints the resulting table
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "command.h"
+#include "registry.h"
+
+#define MAX_SEED 1000000
+
+static const struct {
+   const char *command;
+   const char *argument;
+} key[] = {
+#define GROUP(command, device, setting, summary, title)
+#define ENTRY(command, argument, wire, device, reply, flags, help) { command, argument },
+#include "registry.def"
+#undef ENTRY
+#undef GROUP
+};
+
+#define KEYS (sizeof (key) / sizeof (key[0]))
+
+static int
+TrySeed(unsigned int seed, unsigned int slots, int slot[]) {
+   unsigned int h;
+
+   for (int i=0; i<slots; i++) slot[i] = -1;
+
+   for (int i=0; i<KEYS; i++) {
+      h = RegistryHash(key[i].command, key[i].argument, seed) & (slots - 1);
+
+      if (slot[h] >= 0) return (0);
+
+      slot[h] = i;
+   }
+
+   return (1);
+}
+
+int
+main(int argc, char **argv) {
+   unsigned int slots = 1;
+   int *slot;
+
+   // start with a load factor of at most one half
+   while (slots < 2 * KEYS) slots <<= 1;
+
+   for (;;) {
+      if (!(slot = malloc(slots * sizeof (int)))) return (1);
+
+      for (unsigned int seed=0; seed<MAX_SEED; seed++) {
+         if (!TrySeed(seed, slots, slot)) continue;
+
+         printf("// generated by mkregistry from registry.def, do not edit\n\n");
+         printf("#define REGISTRY_SEED  %10u\n", seed);
+         printf("#define REGISTRY_SLOTS %10u\n\n", slots);
+         printf("static const short registry_slot[REGISTRY_SLOTS] = {");
+
+         for (int i=0; i<slots; i++) {
+            printf("%s%3i,", (i % 16) ? " " : "\n   ", slot[i]);
+         }
+
+         printf("\n};\n");
+
+         free(slot);
+
+         return (0);
+      }
+
+      free(slot);
+
+      slots <<= 1;
+   }
+}
@@ -1,76 +1,96 @@
+#define _POSIX_C_SOURCE 199309L // clock_gettime()
+
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <time.h>
 
 #include "command.h"
 #include "serial.h"
+#include "transaction.h"
 #include "onkyo.h"
 
-Serial *onkyo_serial = NULL;
-
 static int
-ProcessCommand(char ret[], const char *cmd) {
-   unsigned int len = 1;
-   int err = 0;
-
-   if (!onkyo_serial) return (0);
-
-   if (SerialSendBuffer(onkyo_serial, cmd, strlen(cmd))) {
-      SerialClose(onkyo_serial);
-      onkyo_serial = NULL;
-      return (WRITE_ERROR);
-   }
+ReceiveResponse(Device *dev, char ret[], const char *cmd, int timeout) {
+   int len, err = 0;
 
    memset(ret, 0, STRING_SIZE);
 
-   for (int i=0; i<STRING_SIZE; i++) {
-      if (SerialReceiveBuffer(onkyo_serial, &ret[i], &len, 2000)) {
-         // timeout, don't try to read more bytes
-         err = READ_TIMEOUT; break;
-      }
+   // read the whole response up to the terminating NL at once, the bridge
+   // answers free text, so only ordering tells late answers apart
+   len = TransactionReceive(dev, ret, STRING_SIZE - 1, cmd, timeout, NULL);
 
+   if (len < 0) {
+      // timeout, nothing complete to parse
+      return (READ_TIMEOUT);
+   }
+
+   for (int i=0; i<len; i++) {
       if (ret[i] == '?') {
          // unknown command, set error code
          err = UNKNOWN_COMMAND;
       }
 
-      if (ret[i] == '\r') {
-         // received CR, replace by terminating \0
+      if ((ret[i] == '\r') || (ret[i] == '\n')) {
+         // received CR or NL, replace by terminating \0
          ret[i] = '\0';
       }
+   }
 
-      if (ret[i] == '\n') {
-         // received NL, replace by (one more) terminating \0
-         ret[i] = '\0';
-         // ret complete, end loop
-         break;
-      }
+   return (err);
+}
+
+static int
+CommandClass(const char *cmd) {
+   if (!strcmp(cmd, ONKYO_STATUS)) return (DEVICE_CLASS_READ);
+   if (!strcmp(cmd, ONKYO_POWER))  return (DEVICE_CLASS_POWER);
+
+   return (DEVICE_CLASS_SET);
+}
+
+static int
+ProcessCommand(Device *dev, char ret[], const char *cmd) {
+   long start = SerialTimestamp();
+   int err, class = CommandClass(cmd);
+
+   if (!dev->serial) return (NOT_CONNECTED);
+
+   TransactionBegin(dev);
+
+   if (SerialSendBuffer(dev->serial, cmd, strlen(cmd))) {
+      SerialClose(dev->serial);
+      dev->serial = NULL;
+      err = WRITE_ERROR;
+   } else {
+      err = ReceiveResponse(dev, ret, cmd, DeviceTimeout(dev, class));
    }
 
+   DeviceCountCommand(dev, class, start, err);
+
    return (err);
 }
 
 int
-OnkyoProbeDevice(const char *device) {
+OnkyoProbeDevice(Device *dev, const char *node) {
    char ret[STRING_SIZE];
 
-   if ((onkyo_serial = SerialOpen(device)) == NULL) {
+   if ((dev->serial = SerialOpen(node)) == NULL) {
       return (OPEN_FAILED);
    }
 
-   if (SerialInit(onkyo_serial, 19200, "8N1", 0)) {
-      SerialClose(onkyo_serial);   
-      onkyo_serial = NULL;
+   if (SerialInit(dev->serial, ONKYO_BAUD, "8N1", 0)) {
+      SerialClose(dev->serial);   
+      dev->serial = NULL;
       return (OPEN_FAILED);
    }
 
    // wait for arduino bootloader to start sketch
    sleep(1);
 
-   if (OnkyoReadStatus(ret)) {
-      SerialClose(onkyo_serial);   
-      onkyo_serial = NULL;
+   if (OnkyoReadStatus(dev, ret)) {
+      if (dev->serial) SerialClose(dev->serial);   
+      dev->serial = NULL;
       return (NOT_CONNECTED);
    }
 
@@ -78,27 +98,72 @@ OnkyoProbeDevice(const char *device) {
 }
 
 int
-OnkyoReadStatus(char ret[]) {
-   int err = ProcessCommand(ret, "status\n");
+OnkyoRoundTrip(Device *dev, long *us) {
+   char ret[STRING_SIZE];
+   struct timespec start, end;
+   int err;
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+
+   // the cheapest query there is, averaged over a few runs
+   for (int i=0; i<ROUND_TRIPS; i++) {
+      if ((err = ProcessCommand(dev, ret, ONKYO_STATUS))) return (err);
+   }
+
+   clock_gettime(CLOCK_MONOTONIC, &end);
+
+   *us = ((end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000) / ROUND_TRIPS;
+
+   return (0);
+}
+
+int
+OnkyoSetBaudrate(Device *dev, int baud) {
+   char cmd[STRING_SIZE], ret[STRING_SIZE];
+   unsigned int owed;
+   int err, old;
+
+   if (!dev->serial) return (NOT_CONNECTED);
+
+   if ((old = dev->serial->baud) == baud) return (0);
+
+   snprintf(cmd, STRING_SIZE, "baud %i\n", baud);
+
+   // a handshake answer that timed out is garbled by the rate change, it
+   // must not be skipped in place of a later answer
+   owed = dev->owed;
+
+   // the sketch acknowledges at the old rate before it switches over
+   if ((err = ProcessCommand(dev, ret, cmd))) {
+      dev->owed = owed;
+      return (err);
+   }
+
+   if (SerialInit(dev->serial, baud, "8N1", 0)) {
+      SerialInit(dev->serial, old, "8N1", 0);
+      return (INVALID_ARGUMENT);
+   }
+
+   // without a valid command at the new rate the sketch falls back
+   if ((err = OnkyoReadStatus(dev, ret))) {
+      if (dev->serial) SerialInit(dev->serial, old, "8N1", 0);
+      dev->owed = owed;
+      return (err);
+   }
+
+   return (0);
+}
+
+int
+OnkyoReadStatus(Device *dev, char ret[]) {
+   int err = ProcessCommand(dev, ret, ONKYO_STATUS);
 
    return (err);
 }
 
 int
-OnkyoExecCommand(char ret[], const char *arg) {
-   if (!strcmp(arg,   "status")) return (OnkyoReadStatus(ret));
-
-   if (!strcmp(arg,    "power")) return (ProcessCommand(ret,   "power\n"));
-   if (!strcmp(arg,     "vol+")) return (ProcessCommand(ret,    "vol+\n"));
-   if (!strcmp(arg,     "vol-")) return (ProcessCommand(ret,    "vol-\n"));
-   if (!strcmp(arg,     "mute")) return (ProcessCommand(ret,    "mute\n"));
-   if (!strcmp(arg,     "xbox")) return (ProcessCommand(ret,    "xbox\n"));
-   if (!strcmp(arg,      "ps2")) return (ProcessCommand(ret,     "ps2\n"));
-   if (!strcmp(arg,  "speaker")) return (ProcessCommand(ret, "speaker\n"));
-   if (!strcmp(arg,    "movie")) return (ProcessCommand(ret,   "movie\n"));
-   if (!strcmp(arg,     "game")) return (ProcessCommand(ret,    "game\n"));
-   if (!strcmp(arg,    "music")) return (ProcessCommand(ret,   "music\n"));
-   if (!strcmp(arg,   "stereo")) return (ProcessCommand(ret,  "stereo\n"));
-
-   return (INVALID_ARGUMENT);
+OnkyoSendCommand(Device *dev, char ret[], const char *wire) {
+   int err = ProcessCommand(dev, ret, wire);
+
+   return (err);
 }
@@ -7,17 +7,24 @@
 #define WRITE_ERROR              4
 #define READ_TIMEOUT             5
 #define NOT_CONNECTED            6
+#define DEVICE_BUSY              7
+#define DEVICE_UNRESPONSIVE      8
 
-#define STRING_SIZE             32
+#define STRING_SIZE             64
 
-#include "serial.h"
+#define ROUND_TRIPS              5 // queries averaged for latency measurement
 
-extern Serial *onkyo_serial;
+#define ONKYO_BAUD           19200 // rate the arduino sketch starts with
+#define ONKYO_TIMEOUT         2000 // max time the sketch takes to answer in ms
 
-int OnkyoProbeDevice(const char *device);
+#include "device.h"
 
-int OnkyoReadStatus(char ret[]);
+int OnkyoProbeDevice(Device *dev, const char *node);
+int OnkyoRoundTrip(Device *dev, long *us);
+int OnkyoSetBaudrate(Device *dev, int baud);
 
-int OnkyoExecCommand(char ret[], const char *arg);
+int OnkyoReadStatus(Device *dev, char ret[]);
+
+int OnkyoSendCommand(Device *dev, char ret[], const char *wire);
 
 #endif // _Z4CTRL_ONKYO_H_
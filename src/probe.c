@@ -0,0 +1,450 @@
+#define _DEFAULT_SOURCE // realpath(), mkstemp()
+
+#include <sys/stat.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+
+#include "command.h"
+#include "config.h"
+#include "serial.h"
+#include "sanyo.h"
+#include "onkyo.h"
+#include "probe.h"
+
+enum {
+   PROBE_STATE_DONE,
+   PROBE_STATE_SANYO,
+   PROBE_STATE_ONKYO
+};
+
+static int
+IsPowerStatus(const char *frame, int len) {
+   // a projector answers CR0 with a decimal status code and CR
+   if (len < 2) return (0);
+
+   for (int i=0; i<len-1; i++) {
+      if (!isdigit((unsigned char)frame[i])) return (0);
+   }
+
+   return (frame[len-1] == '\r');
+}
+
+static int
+IsOnkyoStatus(const char *frame, int len) {
+   // the arduino bridge answers anything but '?' to a known command
+   return ((len > 0) && !memchr(frame, '?', len));
+}
+
+static void
+ReadFingerprint(Serial *serial, int *state, int *protocol) {
+   char frame[STRING_SIZE];
+   int len;
+
+   // consume everything that is complete right now
+   for (;;) {
+      if (*state == PROBE_STATE_SANYO) {
+         len = SerialReceiveFrame(serial, frame, STRING_SIZE, '\r', 0);
+      } else {
+         len = SerialReceiveFrame(serial, frame, STRING_SIZE, '\n', 0);
+      }
+
+      if (len == SERIAL_ERR_TIMEOUT) return;
+
+      if (len < 0) {
+         // port went away
+         *state = PROBE_STATE_DONE;
+         return;
+      }
+
+      if ((*state == PROBE_STATE_SANYO) && IsPowerStatus(frame, len)) {
+         *protocol = DEVICE_SANYO;
+         *state = PROBE_STATE_DONE;
+         return;
+      }
+
+      if ((*state == PROBE_STATE_ONKYO) && IsOnkyoStatus(frame, len)) {
+         *protocol = DEVICE_ONKYO;
+         *state = PROBE_STATE_DONE;
+         return;
+      }
+   }
+}
+
+int
+ProbeDevices(char *node[], unsigned int number, Device *attached[]) {
+   struct pollfd pfd[number];
+   Serial *serial[number];
+   int state[number], slot[number], protocol[number];
+   int pending, found = 0, onkyo_sent = 0;
+   long start, elapsed;
+
+   if (!number) return (NOT_CONNECTED);
+
+   // open all ports at once and ask each of them for the power status
+   for (int i=0; i<number; i++) {
+      state[i] = PROBE_STATE_DONE;
+      protocol[i] = -1;
+      attached[i] = NULL;
+
+      if ((serial[i] = SerialOpen(node[i])) == NULL) {
+         continue;
+      }
+
+      if (SerialInit(serial[i], 19200, "8N1", 0) ||
+          SerialSendBuffer(serial[i], READ_POWER_STATUS, 4)) {
+         SerialClose(serial[i]);
+         serial[i] = NULL;
+         continue;
+      }
+
+      state[i] = PROBE_STATE_SANYO;
+   }
+
+   start = SerialTimestamp();
+
+   for (;;) {
+      elapsed = SerialTimestamp() - start;
+
+      if ((!onkyo_sent) && (elapsed >= PROBE_TIMEOUT)) {
+         // no projector answered in time, the arduino sketch has long booted
+         for (int i=0; i<number; i++) {
+            if (state[i] != PROBE_STATE_SANYO) continue;
+
+            // a power status that just came in still counts
+            ReadFingerprint(serial[i], &state[i], &protocol[i]);
+
+            if (state[i] != PROBE_STATE_SANYO) continue;
+
+            SerialFlush(serial[i]);
+
+            // leading NL terminates the CR0 the sketch may still buffer
+            if (SerialSendBuffer(serial[i], "\nstatus\n", 8)) {
+               state[i] = PROBE_STATE_DONE;
+            } else {
+               state[i] = PROBE_STATE_ONKYO;
+            }
+         }
+
+         onkyo_sent = 1;
+      }
+
+      if (elapsed >= PROBE_TIMEOUT + PROBE_ONKYO_TIMEOUT) {
+         break;
+      }
+
+      pending = 0;
+
+      for (int i=0; i<number; i++) {
+         if (state[i] == PROBE_STATE_DONE) continue;
+
+         pfd[pending].fd = serial[i]->fd;
+         pfd[pending].events = POLLIN;
+         slot[pending++] = i;
+      }
+
+      if (!pending) break;
+
+      elapsed = ((onkyo_sent) ? PROBE_TIMEOUT + PROBE_ONKYO_TIMEOUT : PROBE_TIMEOUT) - elapsed;
+
+      if (poll(pfd, pending, elapsed) < 0) {
+         if (errno == EINTR) continue;
+
+         break;
+      }
+
+      for (int i=0; i<pending; i++) {
+         if (pfd[i].revents) {
+            ReadFingerprint(serial[slot[i]], &state[slot[i]], &protocol[slot[i]]);
+         }
+      }
+   }
+
+   // hand over what was recognized, close every port that is not ours
+   for (int i=0; i<number; i++) {
+      if (!serial[i]) continue;
+
+      if ((protocol[i] >= 0) && (attached[i] = DeviceAttach(protocol[i], serial[i]))) {
+         found++;
+      } else {
+         SerialClose(serial[i]);
+      }
+   }
+
+   return ((found) ? 0 : NOT_CONNECTED);
+}
+
+static int
+CacheFile(char *file, unsigned int size) {
+   const char *dir;
+
+   if (*(dir = ConfigString("PROBE_CACHE", ""))) {
+      snprintf(file, size, "%s", dir);
+      return (0);
+   }
+
+   // a directory of the invoking user, /run and /tmp are not ours to write
+   if ((dir = getenv("XDG_RUNTIME_DIR")) && *dir) {
+      snprintf(file, size, "%s/%s", dir, PROBE_CACHE_FILE);
+   } else if ((dir = getenv("HOME")) && *dir) {
+      snprintf(file, size, "%s/.cache/%s", dir, PROBE_CACHE_FILE);
+   } else {
+      return (-1);
+   }
+
+   return (0);
+}
+
+static FILE *
+OpenCache(void) {
+   char name[PATH_MAX];
+   struct stat st;
+   FILE *file;
+
+   if (CacheFile(name, sizeof (name)) || !(file = fopen(name, "r"))) {
+      return (NULL);
+   }
+
+   // only a cache written by us or by root is trusted
+   if (fstat(fileno(file), &st) || ((st.st_uid != geteuid()) && st.st_uid)) {
+      fclose(file);
+      return (NULL);
+   }
+
+   return (file);
+}
+
+static Serial *
+OpenDevice(const char *path, const char *device, int baud) {
+   char link[PATH_MAX], *file;
+   Serial *serial = NULL;
+   int match;
+
+   // a link name must not lead out of the serial directory
+   if (strchr(path, '/') || strstr(path, "..")) {
+      return (NULL);
+   }
+
+   // the persistent name must still point to the same node
+   snprintf(link, sizeof (link), "%s/%s", SerialDirectory(), path);
+
+   if (!(file = realpath(link, NULL))) {
+      return (NULL);
+   }
+
+   match = !strcmp(file, device);
+   free(file);
+
+   if (!match) return (NULL);
+
+   if ((serial = SerialOpen(device)) == NULL) {
+      return (NULL);
+   }
+
+   if (SerialInit(serial, baud, "8N1", 0)) {
+      SerialClose(serial);
+      return (NULL);
+   }
+
+   return (serial);
+}
+
+static int
+VerifyDevices(Serial *serial[], int protocol[], int number) {
+   char frame[STRING_SIZE];
+   long start, remaining;
+   int len;
+
+   // DTR stays up between runs, so the arduino is not reset and answers at once
+   for (int i=0; i<number; i++) {
+      if (protocol[i] == DEVICE_SANYO) {
+         if (SerialSendBuffer(serial[i], READ_POWER_STATUS, 4)) return (WRITE_ERROR);
+      } else {
+         if (SerialSendBuffer(serial[i], "status\n", 7)) return (WRITE_ERROR);
+      }
+   }
+
+   start = SerialTimestamp();
+
+   // all queries are out, so the answers are collected under one deadline
+   for (int i=0; i<number; i++) {
+      if ((remaining = PROBE_VERIFY_TIMEOUT - (SerialTimestamp() - start)) < 0) {
+         remaining = 0;
+      }
+
+      if (protocol[i] == DEVICE_SANYO) {
+         len = SerialReceiveFrame(serial[i], frame, STRING_SIZE, '\r', remaining);
+         if (!IsPowerStatus(frame, len)) return (READ_TIMEOUT);
+      } else {
+         len = SerialReceiveFrame(serial[i], frame, STRING_SIZE, '\n', remaining);
+         if (!IsOnkyoStatus(frame, len)) return (READ_TIMEOUT);
+      }
+   }
+
+   return (0);
+}
+
+int
+ProbeLoadCache(const char *name, int kind) {
+   char type[16], path[NAME_MAX + 1], device[PATH_MAX], entry[DEVICE_NAME_SIZE];
+   int protocol[DEVICE_MAX], check[DEVICE_MAX], expect[DEVICE_MAX], baud;
+   int number = 0, checked = 0, stale = 0, named = 0, index[2] = { 0, 0 }, i;
+   Serial *serial[DEVICE_MAX], *verify[DEVICE_MAX];
+   FILE *file;
+
+   if (!(file = OpenCache())) {
+      return (NOT_CONNECTED);
+   }
+
+   // devices are listed in slot order, so they get their old names back
+   while (fscanf(file, "%15s %255s %4095s %i", type, path, device, &baud) == 4) {
+      if (number == DEVICE_MAX) {
+         stale = 1;
+         break;
+      }
+
+      if (!strcmp(type, "sanyo")) {
+         protocol[number] = DEVICE_SANYO;
+      } else if (!strcmp(type, "onkyo")) {
+         // the bridge is not reset on open, so it still runs at the cached rate
+         protocol[number] = DEVICE_ONKYO;
+      } else {
+         stale = 1;
+         break;
+      }
+
+      if (!(serial[number] = OpenDevice(path, device, baud))) {
+         stale = 1;
+         break;
+      }
+
+      // the name the device is going to be attached under
+      snprintf(entry, sizeof (entry), "%s%i", (protocol[number] == DEVICE_SANYO) ? "sanyo" : "onkyo",
+               index[protocol[number]]++);
+
+      if (name && *name) {
+         named += (check[number] = !strcmp(entry, name));
+      } else {
+         check[number] = (kind < 0) || ((protocol[number] == kind) && (index[kind] == 1));
+      }
+
+      number++;
+   }
+
+   fclose(file);
+
+   // only the device the command goes to has to answer, all members of a group
+   for (i=0; i<number; i++) {
+      if (!check[i] && !(name && *name && !named)) continue;
+
+      verify[checked] = serial[i];
+      expect[checked++] = protocol[i];
+   }
+
+   // cache does not match reality anymore, start over
+   if (stale || !checked || VerifyDevices(verify, expect, checked)) {
+      for (i=0; i<number; i++) SerialClose(serial[i]);
+
+      return (NOT_CONNECTED);
+   }
+
+   for (i=0; i<number; i++) {
+      if (!DeviceAttach(protocol[i], serial[i])) break;
+   }
+
+   if (i < number) {
+      for (int j=i; j<number; j++) SerialClose(serial[j]);
+
+      DeviceDetachAll();
+
+      return (NOT_CONNECTED);
+   }
+
+   return (0);
+}
+
+int
+ProbeSaveCache(void) {
+   char path[NAME_MAX + 1], name[PATH_MAX], temp[PATH_MAX], *dir;
+   int found = 0, fd;
+   Device *dev;
+   FILE *file;
+
+   if (CacheFile(name, sizeof (name))) {
+      return (OPEN_FAILED);
+   }
+
+   // ~/.cache may not exist yet
+   snprintf(temp, sizeof (temp), "%s", name);
+
+   if ((dir = strrchr(temp, '/')) && (dir != temp)) {
+      *dir = '\0';
+      mkdir(temp, 0700);
+   }
+
+   // write to a private file first, concurrent runs must never see half a cache,
+   // mkstemp() never follows or reuses a file somebody planted there
+   if ((snprintf(temp, sizeof (temp), "%s.XXXXXX", name) >= sizeof (temp)) ||
+       ((fd = mkstemp(temp)) < 0)) {
+      return (OPEN_FAILED);
+   }
+
+   fchmod(fd, 0644);
+
+   if (!(file = fdopen(fd, "w"))) {
+      close(fd);
+      unlink(temp);
+      return (OPEN_FAILED);
+   }
+
+   for (int i=0; i<DEVICE_MAX; i++) {
+      dev = DeviceSlot(i);
+
+      pthread_mutex_lock(&dev->lock);
+
+      if (dev->serial && !SerialLookupPath(dev->serial->device, path, sizeof (path))) {
+         fprintf(file, "%s %s %s %i\n", (dev->protocol == DEVICE_SANYO) ? "sanyo" : "onkyo",
+                 path, dev->serial->device, dev->serial->baud);
+         found++;
+      }
+
+      pthread_mutex_unlock(&dev->lock);
+   }
+
+   fclose(file);
+
+   if (!found) {
+      unlink(temp);
+      unlink(name);
+      return (NOT_CONNECTED);
+   }
+
+   if (rename(temp, name)) {
+      unlink(temp);
+      return (OPEN_FAILED);
+   }
+
+   return (0);
+}
+
+int
+ProbeLowLatency(Device *dev, long *before, long *after) {
+   int (*round_trip)(Device *dev, long *us);
+   int err;
+
+   round_trip = (dev->protocol == DEVICE_SANYO) ? SanyoRoundTrip : OnkyoRoundTrip;
+
+   if ((err = round_trip(dev, before))) return (err);
+
+   if (SerialSetLowLatency(dev->serial, ConfigInteger("LATENCY_TIMER", PROBE_LATENCY_TIMER))) {
+      return (OPEN_FAILED);
+   }
+
+   return (round_trip(dev, after));
+}
@@ -0,0 +1,21 @@
+#ifndef _Z4CTRL_PROBE_H_
+#define _Z4CTRL_PROBE_H_
+
+#include "device.h"
+
+#define PROBE_TIMEOUT         3000 // time a projector gets to answer CR0 in ms
+#define PROBE_ONKYO_TIMEOUT   1000 // time the booted arduino sketch gets to answer in ms
+#define PROBE_VERIFY_TIMEOUT   500 // deadline for checking a cached port in ms
+
+#define PROBE_LATENCY_TIMER      1 // usb adapter latency timer in ms
+
+#define PROBE_CACHE_FILE "z4ctrl.cache" // in $XDG_RUNTIME_DIR or ~/.cache
+
+int ProbeDevices(char *node[], unsigned int number, Device *attached[]);
+
+int ProbeLoadCache(const char *name, int protocol);
+int ProbeSaveCache(void);
+
+int ProbeLowLatency(Device *dev, long *before, long *after);
+
+#endif // _Z4CTRL_PROBE_H_
@@ -0,0 +1,447 @@
+#define _POSIX_C_SOURCE 200112L // clock_gettime(), pthread_cond_timedwait()
+
+#include <pthread.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+#include "dispatch.h"
+#include "config.h"
+#include "serial.h"
+#include "sanyo.h"
+#include "group.h"
+#include "queue.h"
+
+static void
+Run(Queue *queue, Request *req) {
+   // this thread is the only writer to the device, a batch keeps
+   // the lock for all of its commands so nothing gets in between,
+   // groups take the locks of all their members themselves
+   if (queue->device) pthread_mutex_lock(&queue->device->lock);
+   RequestExecute(req, queue->device, queue->execute);
+   if (queue->device) pthread_mutex_unlock(&queue->device->lock);
+}
+
+static void
+Release(Queue *queue) {
+   Request *req;
+
+   // parked requests go out in order as soon as the projector is ready
+   while (queue->parked_count) {
+      req = queue->parked[queue->parked_head];
+
+      Run(queue, req);
+
+      if (req->waiting) {
+         if (SerialTimestamp() - req->parked < queue->park_timeout) break;
+
+         // projector never settled, give up
+         req->err = DEVICE_BUSY;
+      }
+
+      queue->parked_head = (queue->parked_head + 1) % QUEUE_SIZE;
+      queue->parked_count--;
+
+      req->done(req);
+   }
+}
+
+static void
+Process(Queue *queue, Request *req) {
+   Run(queue, req);
+
+   if (req->waiting && !queue->parked_count) {
+      // the power state may only be assumed, e.g. after "power on" from an
+      // unknown state, so it is asked for before anything gets parked
+      RequestPoll(req, queue->device, queue->execute);
+      queue->poll = SerialTimestamp() + QUEUE_PARK_POLL;
+
+      Run(queue, req);
+   }
+
+   if (req->waiting) {
+      if (queue->parked_count < QUEUE_SIZE) {
+         req->parked = SerialTimestamp();
+
+         queue->parked[(queue->parked_head + queue->parked_count) % QUEUE_SIZE] = req;
+         queue->parked_count++;
+
+         if (req->queued) req->queued(req);
+
+         return;
+      }
+
+      req->err = DEVICE_BUSY;
+   }
+
+   req->done(req);
+}
+
+static void *
+QueueThread(void *arg) {
+   Queue *queue = (Queue *)arg;
+   struct timespec wakeup;
+   Request *req;
+   long delay;
+   int stop;
+
+   for (;;) {
+      pthread_mutex_lock(&queue->mutex);
+
+      while (!queue->count && !queue->stop) {
+         if (!queue->parked_count) {
+            pthread_cond_wait(&queue->cond, &queue->mutex);
+            continue;
+         }
+
+         // parked requests need a look at the power status now and then
+         if ((delay = queue->poll - SerialTimestamp()) <= 0) break;
+
+         clock_gettime(CLOCK_REALTIME, &wakeup);
+         wakeup.tv_nsec += delay * 1000000L;
+         wakeup.tv_sec  += wakeup.tv_nsec / 1000000000L;
+         wakeup.tv_nsec %= 1000000000L;
+
+         if (pthread_cond_timedwait(&queue->cond, &queue->mutex, &wakeup) == ETIMEDOUT) break;
+      }
+
+      req = NULL;
+      stop = queue->stop;
+
+      if (queue->count) {
+         req = queue->request[queue->head];
+         queue->head = (queue->head + 1) % QUEUE_SIZE;
+         queue->count--;
+      }
+
+      pthread_mutex_unlock(&queue->mutex);
+
+      // stop requested and nothing left to do
+      if (!req && stop) break;
+
+      // the poll keeps its own deadline, no matter how often requests arrive
+      if (queue->parked_count && (SerialTimestamp() >= queue->poll)) {
+         RequestPoll(queue->parked[queue->parked_head], queue->device, queue->execute);
+         queue->poll = SerialTimestamp() + QUEUE_PARK_POLL;
+      }
+
+      Release(queue);
+
+      if (req) Process(queue, req);
+   }
+
+   // whatever still waits for a projector is not going to happen anymore
+   while (queue->parked_count) {
+      req = queue->parked[queue->parked_head];
+      queue->parked_head = (queue->parked_head + 1) % QUEUE_SIZE;
+      queue->parked_count--;
+
+      req->err = DEVICE_BUSY;
+      req->done(req);
+   }
+
+   return (NULL);
+}
+
+Queue *
+QueueNew(int (*execute)(Device *dev, char ret[], const char *cmd, const char *arg),
+         Device *device) {
+   Queue *queue;
+
+   if (!(queue = malloc(sizeof (Queue)))) {
+      return (NULL);
+   }
+
+   memset(queue, 0, sizeof (Queue));
+   queue->execute = execute;
+   queue->device = device;
+   queue->park_timeout = ConfigInteger("PARK_TIMEOUT", QUEUE_PARK_TIMEOUT);
+
+   pthread_mutex_init(&queue->mutex, NULL);
+   pthread_cond_init(&queue->cond, NULL);
+
+   if (pthread_create(&queue->tid, NULL, QueueThread, queue)) {
+      pthread_cond_destroy(&queue->cond);
+      pthread_mutex_destroy(&queue->mutex);
+      free(queue);
+      return (NULL);
+   }
+
+   return (queue);
+}
+
+int
+QueueDelete(Queue *queue) {
+   pthread_mutex_lock(&queue->mutex);
+   queue->stop = 1;
+   pthread_cond_signal(&queue->cond);
+   pthread_mutex_unlock(&queue->mutex);
+
+   // pending requests are still executed and completed
+   pthread_join(queue->tid, NULL);
+
+   pthread_cond_destroy(&queue->cond);
+   pthread_mutex_destroy(&queue->mutex);
+   free(queue);
+
+   return (0);
+}
+
+static Request *
+Coalesce(Queue *queue, Request *req) {
+   Request **tail = &queue->request[(queue->head + queue->count - 1) % QUEUE_SIZE];
+   Command *last = &(*tail)->command[0], *next = &req->command[0];
+   Request *dropped;
+   int setting;
+
+   // only single commands right behind each other, anything in between may
+   // depend on the first one, status reads are never merged
+   if (((*tail)->count != 1) || (req->count != 1) || DispatchIsQuery(next->cmd, next->arg)) {
+      return (NULL);
+   }
+
+   if (strcmp(last->cmd, next->cmd)) return (NULL);
+
+   if ((setting = DispatchSetting(next->cmd, next->arg)) != SETTING_NONE) {
+      // "input vga" right before "input hdmi" is pointless
+      if (setting != DispatchSetting(last->cmd, last->arg)) return (NULL);
+
+      // "input hdmi force" must not turn into a plain "input hdmi"
+      next->force |= last->force;
+
+      dropped = *tail;
+      *tail = req;
+
+      strcpy(dropped->ret, "superseded");
+
+      return (dropped);
+   }
+
+   if (strcmp(last->arg, next->arg) || !DispatchIsRepeatable(next->cmd, next->arg)) return (NULL);
+
+   // held buttons, e.g. "press down", become one counted run, presses
+   // beyond the maximum are dropped so the run stops soon after release
+   if (last->repeat + 1 < QUEUE_REPEAT_MAX) {
+      last->repeat++;
+      strcpy(req->ret, "merged");
+   } else {
+      req->err = DEVICE_BUSY;
+   }
+
+   return (req);
+}
+
+int
+QueueSubmit(Queue *queue, Request *req) {
+   Request *dropped = NULL;
+
+   pthread_mutex_lock(&queue->mutex);
+
+   if (queue->stop) {
+      pthread_mutex_unlock(&queue->mutex);
+      return (DEVICE_BUSY);
+   }
+
+   // requests in the ring have not been started yet, parked ones may have
+   if (queue->count && queue->device) dropped = Coalesce(queue, req);
+
+   if (!dropped) {
+      if (queue->count == QUEUE_SIZE) {
+         pthread_mutex_unlock(&queue->mutex);
+         return (DEVICE_BUSY);
+      }
+
+      queue->request[(queue->head + queue->count) % QUEUE_SIZE] = req;
+      queue->count++;
+
+      pthread_cond_signal(&queue->cond);
+   }
+
+   pthread_mutex_unlock(&queue->mutex);
+
+   // completed right away, nothing of it reaches the device
+   if (dropped) dropped->done(dropped);
+
+   return (0);
+}
+
+int
+RequestParse(Request *req, const char *data) {
+   const char *ptr = data;
+   char line[96], flag[8];
+   size_t len;
+   int n;
+
+   req->count = 0;
+   req->members = 0;
+   req->executed = 0;
+   req->ret[0] = '\0';
+   req->target[0] = '\0';
+
+   // "@sanyo1 ..." addresses a device other than the first of its kind
+   if (*ptr == '@') {
+      len = strcspn(++ptr, " \t" BATCH_SEPARATOR);
+
+      if (!len || (len >= DEVICE_NAME_SIZE)) return (INVALID_ARGUMENT);
+
+      memcpy(req->target, ptr, len);
+      req->target[len] = '\0';
+
+      ptr += len;
+   }
+
+   // "power on; input hdmi; color cinema" or one command per line
+   while (*ptr) {
+      len = strcspn(ptr, BATCH_SEPARATOR);
+
+      if (len >= sizeof (line)) return (INVALID_ARGUMENT);
+
+      memcpy(line, ptr, len);
+      line[len] = '\0';
+
+      ptr += len;
+      if (*ptr) ptr++;
+
+      if (req->count == BATCH_SIZE) return (INVALID_ARGUMENT);
+
+      n = sscanf(line, "%31s %31s %7s", req->command[req->count].cmd,
+                                        req->command[req->count].arg, flag);
+
+      if (n < 1) {
+         // empty part, e.g. trailing separator
+         continue;
+      }
+
+      // "input hdmi force" goes out even if hdmi is selected already
+      req->command[req->count].force = ((n == 3) && !strcmp(flag, "force"));
+
+      req->count++;
+   }
+
+   return ((req->count) ? 0 : UNKNOWN_COMMAND);
+}
+
+int
+RequestRoute(Request *req, Device **dev) {
+   int protocol = DispatchDevice(req->command[0].cmd, req->command[0].arg);
+
+   req->members = 0;
+
+   if (req->target[0]) {
+      *dev = DeviceFind(req->target);
+   } else {
+      *dev = DeviceDefault(protocol);
+   }
+
+   if (!*dev && req->target[0]) {
+      // a group fans out exactly one command to all of its members
+      if (req->count > 1) return (INVALID_ARGUMENT);
+
+      return (GroupFind(req->target, req->member, &req->members));
+   }
+
+   if (!*dev) return (NOT_CONNECTED);
+
+   // a batch runs on one executor, so it must not span several devices
+   for (int i=0; i<req->count; i++) {
+      if (DispatchDevice(req->command[i].cmd, req->command[i].arg) != (*dev)->protocol) {
+         return (INVALID_ARGUMENT);
+      }
+   }
+
+   return (0);
+}
+
+static int
+ExecuteGroup(Request *req) {
+   GroupResult result;
+   size_t len = 0;
+
+   req->err = GroupExecute(req->member, req->members, req->command[0].cmd,
+                           req->command[0].arg, req->command[0].force, &result);
+
+   if ((req->waiting = result.waiting)) return (0);
+
+   // e.g. "sanyo0 !, sanyo1 error 5, gap 42 us"
+   for (int i=0; i<result.written; i++) {
+      if (result.err[i]) {
+         len += snprintf(req->ret + len, sizeof (req->ret) - len, "%s error %i, ",
+                         req->member[i]->name, result.err[i]);
+      } else {
+         len += snprintf(req->ret + len, sizeof (req->ret) - len, "%s %s, ",
+                         req->member[i]->name, result.ret[i]);
+      }
+
+      if (len >= sizeof (req->ret)) len = sizeof (req->ret) - 1;
+   }
+
+   if (len) snprintf(req->ret + len, sizeof (req->ret) - len, "gap %li us", result.gap);
+
+   req->executed = (req->err) ? 0 : 1;
+
+   return (req->err);
+}
+
+int
+RequestExecute(Request *req, Device *dev,
+               int (*execute)(Device *dev, char ret[], const char *cmd, const char *arg)) {
+   char ret[STRING_SIZE];
+   size_t len;
+
+   // a parked request goes on where it stopped
+   if (!req->executed) req->ret[0] = '\0';
+
+   len = strlen(req->ret);
+   req->waiting = 0;
+   req->err = 0;
+
+   if (req->members) return (ExecuteGroup(req));
+
+   for (int i=req->executed; i<req->count; i++) {
+      // the projector ignores commands while warming up or cooling down
+      if ((req->waiting = DispatchMustWait(dev, req->command[i].cmd, req->command[i].arg))) {
+         break;
+      }
+
+      ret[0] = '\0';
+
+      if (!req->command[i].force && DispatchIsCurrent(dev, req->command[i].cmd, req->command[i].arg)) {
+         // the projector has this setting already, spare it the re-sync
+         strcpy(ret, "!");
+         dev->stats.elided++;
+      } else {
+         // merged button presses go out back-to-back
+         for (int r=0; (r<=req->command[i].repeat) && !req->err; r++) {
+            req->err = execute(dev, ret, req->command[i].cmd, req->command[i].arg);
+         }
+
+         // stop at the first failure, later commands usually depend on it
+         if (req->err) break;
+      }
+
+      len += snprintf(req->ret + len, sizeof (req->ret) - len, "%s%s", (i) ? "; " : "", ret);
+      req->executed++;
+   }
+
+   return (req->err);
+}
+
+int
+RequestPoll(Request *req, Device *dev,
+            int (*execute)(Device *dev, char ret[], const char *cmd, const char *arg)) {
+   unsigned int count = (req->members) ? req->members : 1;
+   char ret[STRING_SIZE];
+
+   // ask the projectors a parked request waits for about their power state
+   for (int i=0; i<count; i++) {
+      if (req->members) dev = req->member[i];
+
+      pthread_mutex_lock(&dev->lock);
+      if (SanyoPowerBusy(dev)) execute(dev, ret, "status", "power");
+      pthread_mutex_unlock(&dev->lock);
+   }
+
+   return (0);
+}
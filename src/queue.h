@@ -0,0 +1,72 @@
+#ifndef _Z4CTRL_QUEUE_H_
+#define _Z4CTRL_QUEUE_H_
+
+#include <pthread.h>
+
+#include "sanyo.h"
+#include "device.h"
+
+#define QUEUE_SIZE              16 // max number of pending requests per device
+#define QUEUE_REPEAT_MAX         8 // max length of a run of merged button presses
+#define BATCH_SIZE               8 // max number of commands in one request
+
+#define QUEUE_PARK_POLL        500 // power status poll interval while requests are parked in ms
+#define QUEUE_PARK_TIMEOUT  120000 // max time a request waits for a projector to settle in ms
+
+#define BATCH_SEPARATOR      ";\n" // characters that split a batch into commands
+#define BATCH_RESULT_SIZE (BATCH_SIZE * (STRING_SIZE + 2))
+
+typedef struct Command {
+   char cmd[32];
+   char arg[32];
+   int force;                         ///< send even if the setting is already active
+   unsigned int repeat;               ///< identical requests merged into this one
+} Command;
+
+typedef struct Request {
+   char target[DEVICE_NAME_SIZE];     ///< device or group given as "@name", empty for the default
+   Device *member[DEVICE_MAX];        ///< devices of a group in slot order
+   unsigned int members;              ///< 0 unless the target is a group
+   Command command[BATCH_SIZE];       ///< executed back-to-back in this order
+   unsigned int count;
+   unsigned int executed;             ///< number of commands that were answered
+   char ret[BATCH_RESULT_SIZE];       ///< responses joined by "; "
+   int err;                           ///< error of the first failing command
+   int waiting;                       ///< next command has to wait for the projector to settle
+   long parked;                       ///< time the request was parked in ms, 0 if never
+   void *user_data;
+   void (*queued)(struct Request *req); ///< called once when the request gets parked, may be NULL
+   void (*done)(struct Request *req); ///< called by the executor when finished
+} Request;
+
+typedef struct Queue {
+   Request *request[QUEUE_SIZE];      ///< ring buffer of pending requests
+   unsigned int head;
+   unsigned int count;
+   Request *parked[QUEUE_SIZE];       ///< requests waiting for a projector, only used by the executor
+   unsigned int parked_head;
+   unsigned int parked_count;
+   int park_timeout;                  ///< parked requests fail with DEVICE_BUSY after this in ms
+   long poll;                         ///< time of the next power status poll for parked requests in ms
+   int stop;
+   pthread_mutex_t mutex;
+   pthread_cond_t cond;
+   pthread_t tid;
+   Device *device;                    ///< locked while a request executes, NULL for groups
+   int (*execute)(Device *dev, char ret[], const char *cmd, const char *arg);
+} Queue;
+
+Queue *QueueNew(int (*execute)(Device *dev, char ret[], const char *cmd, const char *arg),
+                Device *device);
+
+int QueueDelete(Queue *queue);
+int QueueSubmit(Queue *queue, Request *req);
+
+int RequestParse(Request *req, const char *data);
+int RequestRoute(Request *req, Device **dev);
+int RequestExecute(Request *req, Device *dev,
+                   int (*execute)(Device *dev, char ret[], const char *cmd, const char *arg));
+int RequestPoll(Request *req, Device *dev,
+                int (*execute)(Device *dev, char ret[], const char *cmd, const char *arg));
+
+#endif // _Z4CTRL_QUEUE_H_
@@ -0,0 +1,49 @@
+#include <string.h>
+
+#include "command.h"
+#include "registry.h"
+#include "registry_hash.h"
+
+const Entry registry[] = {
+#define GROUP(command, device, setting, summary, title)
+#define ENTRY(command, argument, wire, device, reply, flags, help) \
+   { command, argument, wire, device, reply, flags, help },
+#include "registry.def"
+#undef ENTRY
+#undef GROUP
+};
+
+const unsigned int registry_size = sizeof (registry) / sizeof (registry[0]);
+
+const Group registry_group[] = {
+#define GROUP(command, device, setting, summary, title) \
+   { command, device, setting, summary, title },
+#define ENTRY(command, argument, wire, device, reply, flags, help)
+#include "registry.def"
+#undef ENTRY
+#undef GROUP
+};
+
+const unsigned int registry_groups = sizeof (registry_group) / sizeof (registry_group[0]);
+
+const Entry *
+RegistryLookup(const char *cmd, const char *arg) {
+   int i = registry_slot[RegistryHash(cmd, arg, REGISTRY_SEED) & (REGISTRY_SLOTS - 1)];
+
+   // the table is perfect, one compare tells hit from miss
+   if ((i < 0) || strcmp(registry[i].command, cmd) || strcmp(registry[i].argument, arg)) {
+      return (NULL);
+   }
+
+   return (&registry[i]);
+}
+
+const Group *
+RegistryGroup(const char *cmd) {
+   // only needed for help and error reporting, no hashing
+   for (int i=0; i<registry_groups; i++) {
+      if (!strcmp(registry_group[i].command, cmd)) return (&registry_group[i]);
+   }
+
+   return (NULL);
+}
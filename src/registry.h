@@ -0,0 +1,75 @@
+#ifndef _Z4CTRL_REGISTRY_H_
+#define _Z4CTRL_REGISTRY_H_
+
+enum {
+   DEVICE_SANYO,
+   DEVICE_ONKYO
+};
+
+enum {
+   REPLY_TEXT,                        // response is passed on as is
+   REPLY_POWER,                       // power status code
+   REPLY_INPUT,                       // input mode code
+   REPLY_HOURS,                       // number with leading zeros
+   REPLY_ALL                          // all status reads one after the other
+};
+
+// settings the projector keeps, re-sending the active one is a no-op
+enum {
+   SETTING_NONE = -1,
+   SETTING_INPUT,
+   SETTING_SCALER,
+   SETTING_LAMP,
+   SETTING_COLOR,
+   SETTING_MUTE,
+   SETTINGS
+};
+
+// properties of a single command
+enum {
+   ENTRY_READ   = 1,                  // only reads, changes nothing on the device
+   ENTRY_REPEAT = 2                   // a button, identical presses in a row may go out as one run
+};
+
+typedef struct Entry {
+   const char *command;
+   const char *argument;              ///< empty for commands without argument
+   const char *wire;                  ///< bytes sent to the device
+   int device;
+   int reply;                         ///< how the response gets decoded
+   int flags;                         ///< ENTRY_READ, ENTRY_REPEAT or 0
+   const char *help;
+} Entry;
+
+typedef struct Group {
+   const char *command;
+   int device;
+   int setting;                       ///< one of SETTING_*, SETTING_NONE for actions
+   const char *summary;               ///< one line on the usage screen
+   const char *title;                 ///< heading of the argument list
+} Group;
+
+extern const Entry registry[];
+extern const unsigned int registry_size;
+
+extern const Group registry_group[];
+extern const unsigned int registry_groups;
+
+// FNV-1a over "command argument", shared with the generator of the hash table
+static inline unsigned int
+RegistryHash(const char *cmd, const char *arg, unsigned int seed) {
+   unsigned int hash = 2166136261u ^ seed;
+
+   while (*cmd) hash = (hash ^ (unsigned char)*cmd++) * 16777619u;
+
+   hash = (hash ^ ' ') * 16777619u;
+
+   while (*arg) hash = (hash ^ (unsigned char)*arg++) * 16777619u;
+
+   return (hash ^ (hash >> 15));
+}
+
+const Entry *RegistryLookup(const char *cmd, const char *arg);
+const Group *RegistryGroup(const char *cmd);
+
+#endif // _Z4CTRL_REGISTRY_H_
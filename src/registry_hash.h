@@ -0,0 +1,23 @@
+// generated by mkregistry from registry.def, do not edit
+
+#define REGISTRY_SEED        1506
+#define REGISTRY_SLOTS        256
+
+static const short registry_slot[REGISTRY_SLOTS] = {
+    -1,  -1,  -1,  -1,  -1,  28,  52,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,
+    -1,  -1,   4,  49,  -1,  11,  -1,  -1,  -1,  56,  -1,  -1,  -1,  -1,  -1,  -1,
+    -1,  34,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  22,  -1,  -1,  -1,  -1,
+    -1,  -1,  18,  -1,  -1,  -1,  20,  -1,  -1,  -1,  -1,  -1,  -1,   1,  -1,  -1,
+    -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,   7,  -1,  -1,   0,  12,  -1,
+    -1,  24,  -1,  45,  -1,   6,  -1,  -1,  -1,  -1,  -1,  63,  46,  -1,  -1,   9,
+    -1,  -1,  59,  -1,  -1,  -1,  -1,  -1,  33,  -1,  -1,  -1,  -1,  42,  -1,  -1,
+    13,  -1,  61,  -1,  -1,  -1,  -1,  -1,  -1,  38,  -1,  43,  -1,  47,  26,  -1,
+    -1,  -1,  31,  -1,   5,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,   2,  -1,
+    -1,  -1,  -1,  -1,   3,  -1,  14,  36,  -1,  -1,  -1,  37,  -1,  -1,  -1,  -1,
+    -1,  29,  -1,  -1,  -1,  -1,  -1,  -1,  21,  -1,  60,  -1,  40,  -1,  50,  -1,
+    -1,  -1,  -1,  27,  16,  -1,  35,  15,  -1,  -1,  -1,  -1,  51,  -1,  -1,  -1,
+    53,  -1,  -1,  -1,  39,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  19,
+    58,  -1,   8,  55,  -1,  25,  17,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,
+    -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  10,  -1,  48,  -1,  23,  30,  44,  41,
+    -1,  -1,  -1,  -1,  32,  54,  -1,  -1,  -1,  -1,  -1,  57,  -1,  62,  -1,  -1,
+};
@@ -1,34 +1,58 @@
+#define _POSIX_C_SOURCE 199309L // clock_gettime()
+
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
 
 #include "command.h"
 #include "serial.h"
+#include "registry.h"
+#include "transaction.h"
 #include "sanyo.h"
 
-Serial *sanyo_serial = NULL;
-
 static int
-ProcessCommand(char ret[], const char *cmd) {
-   unsigned int len = 1;
-   int err = 0;
+Plausible(const char *cmd, const char *frame, int len) {
+   int digits = 0, ack = ((len == 2) && (frame[0] == 0x06));
 
-   if (!sanyo_serial) return (0);
+   while ((digits < len) && (frame[digits] >= '0') && (frame[digits] <= '9')) digits++;
 
-   if (SerialSendBuffer(sanyo_serial, cmd, 4)) {
-      SerialClose(sanyo_serial);   
-      sanyo_serial = NULL;
-      return (WRITE_ERROR);
-   }
+   // everything the projector does not know or want is answered with '?'
+   if (memchr(frame, '?', len)) return (1);
+
+   // commands get an ACK, status reads never do
+   if (strncmp(cmd, "CR", 2)) return (ack);
+   if (ack) return (0);
+
+   digits = (digits) ? digits + 1 == len : 0;
+
+   if (!strcmp(cmd, READ_POWER_STATUS)) return (digits && (len == 3));
+   if (!strcmp(cmd, READ_INPUT_MODE))   return (digits && (len <= 3));
+   if (!strcmp(cmd, READ_LAMP_HOURS))   return (digits && (len > 3));
+
+   // model number and temperatures are text
+   if (!strcmp(cmd, READ_MODEL_NUMBER) || !strcmp(cmd, READ_TEMP_SENSORS)) return (!digits);
+
+   // generic reads may answer anything but an ACK
+   return (1);
+}
+
+static int
+ReceiveResponse(Device *dev, char ret[], const char *cmd, int timeout) {
+   int len, err = 0;
 
    memset(ret, 0, STRING_SIZE);
 
-   for (int i=0; i<STRING_SIZE; i++) {
-      if (SerialReceiveBuffer(sanyo_serial, &ret[i], &len, 3000)) {
-         // timeout, don't try to read more bytes
-         err = READ_TIMEOUT; break;
-      }
+   // read the whole response up to the terminating CR at once, late
+   // answers to earlier commands are skipped
+   len = TransactionReceive(dev, ret, STRING_SIZE - 1, cmd, timeout, Plausible);
+
+   if (len < 0) {
+      // timeout, nothing complete to parse
+      return (READ_TIMEOUT);
+   }
 
+   for (int i=0; i<len; i++) {
       if (ret[i] == '?') {
          // unknown command, set error code
          err = UNKNOWN_COMMAND;
@@ -42,31 +66,121 @@ ProcessCommand(char ret[], const char *cmd) {
       if (ret[i] == '\r') {
          // received CR, replace by terminating \0
          ret[i] = '\0';
-         // ret complete, end loop
+      }
+   }
+
+   return (err);
+}
+
+static int
+SendCommand(Device *dev, const char *cmd, int len) {
+   if (!dev->serial) return (NOT_CONNECTED);
+
+   if (SerialSendBuffer(dev->serial, cmd, len)) {
+      SerialClose(dev->serial);   
+      dev->serial = NULL;
+      return (WRITE_ERROR);
+   }
+
+   return (0);
+}
+
+static void
+SetPower(Device *dev, int power) {
+   // after a power cycle the projector may come up with other settings
+   if (dev->power != power) memset(dev->setting, 0, sizeof (dev->setting));
+
+   dev->power = power;
+}
+
+static void
+SetInput(Device *dev, int input) {
+   const char *wire = NULL;
+
+   switch (input) {
+      case SANYO_INPUT_COMPOSIT:    wire = INPUT_COMPOSIT;    break;
+      case SANYO_INPUT_SVIDEO:      wire = INPUT_SVIDEO;      break;
+      case SANYO_INPUT_COMPONENT_1: wire = INPUT_COMPONENT_1; break;
+      case SANYO_INPUT_COMPONENT_2: wire = INPUT_COMPONENT_2; break;
+      case SANYO_INPUT_HDMI:        wire = INPUT_HDMI;        break;
+      case SANYO_INPUT_VGA:         wire = INPUT_VGA;         break;
+   }
+
+   // the remote or the front panel may have switched inputs behind our back,
+   // an input that can not be selected here leaves the setting unknown
+   dev->setting[SETTING_INPUT] = NULL;
+
+   for (int i=0; wire && (i<registry_size); i++) {
+      if ((registry[i].device == DEVICE_SANYO) && !strcmp(registry[i].wire, wire)) {
+         dev->setting[SETTING_INPUT] = &registry[i];
          break;
       }
    }
+}
+
+static void
+TrackState(Device *dev, const char *cmd, const char ret[]) {
+   // follow the power state machine, acknowledged switches start a transition,
+   // a wrong guess from an unknown state costs one status read to correct
+   if (!strcmp(cmd, READ_POWER_STATUS)) {
+      SetPower(dev, atoi(ret));
+   } else if (!strcmp(cmd, READ_INPUT_MODE)) {
+      SetInput(dev, atoi(ret));
+   } else if (!strcmp(cmd, POWER_ON) && ((dev->power == SANYO_POWER_STANDBY) ||
+                                         (dev->power == SANYO_POWER_UNKNOWN))) {
+      SetPower(dev, SANYO_POWER_COUNTDOWN);
+   } else if (!strcmp(cmd, POWER_OFF_QUICK) && ((dev->power == SANYO_POWER_ON) ||
+                                                (dev->power == SANYO_POWER_UNKNOWN))) {
+      SetPower(dev, SANYO_POWER_COOLING);
+   }
+}
+
+static int
+CommandClass(const char *cmd) {
+   if (!strncmp(cmd, "CR", 2)) return (DEVICE_CLASS_READ);
+
+   if (!strcmp(cmd, POWER_ON) || !strcmp(cmd, POWER_OFF_QUICK) || !strcmp(cmd, POWER_OFF_ASK)) {
+      return (DEVICE_CLASS_POWER);
+   }
+
+   return (DEVICE_CLASS_SET);
+}
+
+static int
+ProcessCommand(Device *dev, char ret[], const char *cmd) {
+   long start = SerialTimestamp();
+   int err, class = CommandClass(cmd);
+
+   TransactionBegin(dev);
+
+   if (!(err = SendCommand(dev, cmd, 4))) {
+      err = ReceiveResponse(dev, ret, cmd, DeviceTimeout(dev, class));
+   }
+
+   DeviceCountCommand(dev, class, start, err);
+
+   if (!err) TrackState(dev, cmd, ret);
 
    return (err);
 }
 
 int
-SanyoProbeDevice(const char *device) {
+SanyoProbeDevice(Device *dev, const char *node) {
    char ret[STRING_SIZE];
 
-   if ((sanyo_serial = SerialOpen(device)) == NULL) {
+   if ((dev->serial = SerialOpen(node)) == NULL) {
       return (OPEN_FAILED);
    }
 
-   if (SerialInit(sanyo_serial, 19200, "8N1", 0)) {
-      SerialClose(sanyo_serial);
-      sanyo_serial = NULL;
+   if (SerialInit(dev->serial, 19200, "8N1", 0)) {
+      SerialClose(dev->serial);
+      dev->serial = NULL;
       return (OPEN_FAILED);
    }
 
-   if (ReadPowerStatus(ret)) {
-      SerialClose(sanyo_serial);
-      sanyo_serial = NULL;
+   if (ReadPowerStatus(dev, ret)) {
+      if (dev->serial) SerialClose(dev->serial);
+      dev->serial = NULL;
       return (NOT_CONNECTED);
    }
 
@@ -74,193 +188,231 @@ SanyoProbeDevice(const char *device) {
 }
 
 int
-ReadPowerStatus(char ret[]) {
-   char *status = NULL;
+SanyoRoundTrip(Device *dev, long *us) {
+   char ret[STRING_SIZE];
+   struct timespec start, end;
    int err;
 
-   if (!(err = ProcessCommand(ret, READ_POWER_STATUS))) {
-      switch (atoi((char *)ret)) {
-         case 00: status = "power on";                                             break;
-         case 80: status = "stand-by";                                             break;
-         case 40: status = "processing countdown";                                 break;
-         case 20: status = "processing cooling down";                              break;
-         case 10: status = "power failure";                                        break;
-         case 28: status = "processing cooling down due to abnormal temperature";  break;
-         case 88: status = "stand-by due to abnormal temperature or door failure"; break;
-         case 24: status = "processing power save / cooling down";                 break;
-         case 04: status = "power save";                                           break;
-         case 21: status = "processing cooling down after lamp failure";           break;
-         case 81: status = "stand-by after cooling down due to lamp failure";      break;
-      }
+   clock_gettime(CLOCK_MONOTONIC, &start);
 
-      strcpy(ret, status);
+   // the cheapest query there is, averaged over a few runs
+   for (int i=0; i<ROUND_TRIPS; i++) {
+      if ((err = ProcessCommand(dev, ret, READ_POWER_STATUS))) return (err);
    }
 
-   return (err);
+   clock_gettime(CLOCK_MONOTONIC, &end);
+
+   *us = ((end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000) / ROUND_TRIPS;
+
+   return (0);
 }
 
-int
-ReadInputMode(char ret[]) {
-   char *input = NULL;
-   int err;
+static void
+DecodePowerStatus(char ret[]) {
+   char *status = NULL;
 
-   if (!(err = ProcessCommand(ret, READ_INPUT_MODE))) {
-      switch (atoi((char *)ret)) {
-         case 0: input = "composit";    break;
-         case 1: input = "s-video";     break;
-         case 2: input = "component 1"; break;
-         case 3: input = "component 2"; break;
-         case 4: input = "hdmi";        break;
-         case 5: input = "vga";         break;
-         case 6: input = "scart";       break;
-      }
+   switch (atoi((char *)ret)) {
+      case SANYO_POWER_ON:           status = "power on";                                             break;
+      case SANYO_POWER_STANDBY:      status = "stand-by";                                             break;
+      case SANYO_POWER_COUNTDOWN:    status = "processing countdown";                                 break;
+      case SANYO_POWER_COOLING:      status = "processing cooling down";                              break;
+      case SANYO_POWER_FAILURE:      status = "power failure";                                        break;
+      case SANYO_POWER_COOLING_TEMP: status = "processing cooling down due to abnormal temperature";  break;
+      case SANYO_POWER_STANDBY_TEMP: status = "stand-by due to abnormal temperature or door failure"; break;
+      case SANYO_POWER_COOLING_SAVE: status = "processing power save / cooling down";                 break;
+      case SANYO_POWER_SAVE:         status = "power save";                                           break;
+      case SANYO_POWER_COOLING_LAMP: status = "processing cooling down after lamp failure";           break;
+      case SANYO_POWER_STANDBY_LAMP: status = "stand-by after cooling down due to lamp failure";      break;
+   }
+
+   // unknown codes are passed on as they are
+   if (status) strcpy(ret, status);
+}
 
-      strcpy(ret, input);
+static void
+DecodeInputMode(char ret[]) {
+   char *input = NULL;
+
+   switch (atoi((char *)ret)) {
+      case SANYO_INPUT_COMPOSIT:    input = "composit";    break;
+      case SANYO_INPUT_SVIDEO:      input = "s-video";     break;
+      case SANYO_INPUT_COMPONENT_1: input = "component 1"; break;
+      case SANYO_INPUT_COMPONENT_2: input = "component 2"; break;
+      case SANYO_INPUT_HDMI:        input = "hdmi";        break;
+      case SANYO_INPUT_VGA:         input = "vga";         break;
+      case SANYO_INPUT_SCART:       input = "scart";       break;
    }
 
-   return (err);
+   if (input) strcpy(ret, input);
+}
+
+static void
+DecodeReply(char ret[], int reply) {
+   switch (reply) {
+      case REPLY_POWER: DecodePowerStatus(ret);          break;
+      case REPLY_INPUT: DecodeInputMode(ret);            break;
+      case REPLY_HOURS: sprintf(ret, "%i", atoi(ret));   break; // strip leading zeros
+   }
 }
 
 int
-ReadLampHours(char ret[]) {
+SanyoSendCommand(Device *dev, char ret[], const char *wire, int reply) {
+   SanyoStatus status;
    int err;
 
-   if (!(err = ProcessCommand(ret, READ_LAMP_HOURS))) {
-      sprintf(ret, "%i", atoi(ret)); // strip leading zeros
+   if (reply == REPLY_ALL) {
+      if (!(err = SanyoReadStatus(dev, &status))) {
+         SanyoFormatStatus(ret, &status);
+      }
+
+      return (err);
    }
 
-   return (err);
+   if ((err = ProcessCommand(dev, ret, wire))) {
+      return (err);
+   }
+
+   DecodeReply(ret, reply);
+
+   return (0);
 }
 
 int
-ReadTempSensors(char ret[]) {
-   int err = ProcessCommand(ret, READ_TEMP_SENSORS);
-
-   return (err);
+SanyoWriteCommand(Device *dev, const char *wire) {
+   return (SendCommand(dev, wire, strlen(wire)));
 }
 
 int
-ReadModelNumber(char ret[]) {
-   int err = ProcessCommand(ret, READ_MODEL_NUMBER);
+SanyoReadReply(Device *dev, char ret[], const char *wire, int reply, long start) {
+   long remaining = start + DeviceTimeout(dev, CommandClass(wire)) - SerialTimestamp();
+   int err;
+
+   // the deadline runs from the write, not from the start of the read
+   err = ReceiveResponse(dev, ret, wire, (remaining > 0) ? remaining : 0);
+
+   DeviceCountCommand(dev, CommandClass(wire), start, err);
+
+   if (!err) {
+      TrackState(dev, wire, ret);
+      DecodeReply(ret, reply);
+   }
 
    return (err);
 }
 
 int
-ExecStatusRead(char ret[], const char *arg) {
-   if (!strcmp(arg,    "power")) return (ReadPowerStatus(ret));
-   if (!strcmp(arg,    "input")) return (ReadInputMode(ret));
-   if (!strcmp(arg,     "lamp")) return (ReadLampHours(ret));
-   if (!strcmp(arg,     "temp")) return (ReadTempSensors(ret));
+SanyoPowerBusy(const Device *dev) {
+   switch (dev->power) {
+      case SANYO_POWER_COUNTDOWN:
+      case SANYO_POWER_COOLING:
+      case SANYO_POWER_COOLING_LAMP:
+      case SANYO_POWER_COOLING_SAVE:
+      case SANYO_POWER_COOLING_TEMP:
+         return (1);
+   }
 
-   return (INVALID_ARGUMENT);
+   return (0);
 }
 
 int
-ExecPowerCommand(char ret[], const char *arg) {
-   if (!strcmp(arg,       "on")) return (ProcessCommand(ret, POWER_ON));
-   if (!strcmp(arg,      "off")) return (ProcessCommand(ret, POWER_OFF_QUICK));
-   if (!strcmp(arg,      "ask")) return (ProcessCommand(ret, POWER_OFF_ASK));
+SanyoReadStatus(Device *dev, SanyoStatus *status) {
+   static const char *query[5] = {
+      READ_POWER_STATUS, READ_INPUT_MODE, READ_LAMP_HOURS, READ_MODEL_NUMBER, READ_TEMP_SENSORS
+   };
+   char frame[5][STRING_SIZE];
+   int err[5];
+   long start;
 
-   return (INVALID_ARGUMENT);
-}
+   TransactionBegin(dev);
 
-int
-ExecLogoCommand(char ret[], const char *arg) {
-   if (!strcmp(arg,      "off")) return (ProcessCommand(ret, LOGO_OFF));
-   if (!strcmp(arg,  "default")) return (ProcessCommand(ret, LOGO_DEFAULT));
-   if (!strcmp(arg,     "user")) return (ProcessCommand(ret, LOGO_USER));
-   if (!strcmp(arg,  "capture")) return (ProcessCommand(ret, LOGO_CAPTURE));
+   // the projector handles one command at a time and may drop what arrives
+   // meanwhile, so every query waits for the answer to the one before
+   for (int i=0; i<5; i++) {
+      start = SerialTimestamp();
 
-   return (INVALID_ARGUMENT);
-}
+      if ((err[i] = SendCommand(dev, query[i], 4))) return (err[i]);
 
-int
-ExecMenuCommand(char ret[], const char *arg) {
-   if (!strcmp(arg,       "on")) return (ProcessCommand(ret, MENU_ON));
-   if (!strcmp(arg,      "off")) return (ProcessCommand(ret, MENU_OFF));
-   if (!strcmp(arg,    "clear")) return (ProcessCommand(ret, MENU_CLEAR));
+      err[i] = ReceiveResponse(dev, frame[i], query[i], DeviceTimeout(dev, DEVICE_CLASS_READ));
+
+      DeviceCountCommand(dev, DEVICE_CLASS_READ, start, err[i]);
+
+      // the late answer is owed, nothing else was sent after it
+      if (err[i] == READ_TIMEOUT) return (READ_TIMEOUT);
+   }
+
+   memset(status, 0, sizeof (SanyoStatus));
+
+   status->power = (err[0]) ? SANYO_POWER_UNKNOWN : atoi(frame[0]);
 
-   return (INVALID_ARGUMENT);
+   if (!err[0]) SetPower(dev, status->power);
+   status->input = (err[1]) ? SANYO_INPUT_UNKNOWN : atoi(frame[1]);
+
+   if (!err[1]) SetInput(dev, status->input);
+   status->lamp_hours = (err[2]) ? -1 : atoi(frame[2]);
+
+   if (!err[3]) strcpy(status->model, frame[3]);
+
+   if (!err[4]) {
+      status->temps = sscanf(frame[4], "%f %f %f", &status->temp[0],
+                             &status->temp[1], &status->temp[2]);
+      if (status->temps < 0) status->temps = 0;
+   }
+
+   // without a power status nothing else is trustworthy
+   return ((err[0]) ? err[0] : 0);
 }
 
 int
-ExecPressCommand(char ret[], const char *arg) {
-   if (!strcmp(arg,    "right")) return (ProcessCommand(ret, PRESS_RIGHT));
-   if (!strcmp(arg,     "left")) return (ProcessCommand(ret, PRESS_LEFT));
-   if (!strcmp(arg,       "up")) return (ProcessCommand(ret, PRESS_UP));
-   if (!strcmp(arg,     "down")) return (ProcessCommand(ret, PRESS_DOWN));
-   if (!strcmp(arg,    "enter")) return (ProcessCommand(ret, PRESS_ENTER));
-
-   return (INVALID_ARGUMENT);
+SanyoFormatStatus(char ret[], const SanyoStatus *status) {
+   int len;
+
+   len = snprintf(ret, STRING_SIZE, "power=%i input=%i lamp=%i temp=", status->power,
+                  status->input, status->lamp_hours);
+
+   // long models or absurd readings from the wire are cut off, never overflow
+   if (len >= STRING_SIZE) len = STRING_SIZE - 1;
+
+   for (int i=0; i<status->temps; i++) {
+      len += snprintf(ret + len, STRING_SIZE - len, "%s%.1f", (i) ? "/" : "", status->temp[i]);
+      if (len >= STRING_SIZE) len = STRING_SIZE - 1;
+   }
+
+   len += snprintf(ret + len, STRING_SIZE - len, " model=%s", status->model);
+   if (len >= STRING_SIZE) len = STRING_SIZE - 1;
+
+   return (len);
 }
 
 int
-ExecInputCommand(char ret[], const char *arg) {
-   if (!strcmp(arg,    "video")) return (ProcessCommand(ret, INPUT_COMPOSIT));
-   if (!strcmp(arg,  "s-video")) return (ProcessCommand(ret, INPUT_SVIDEO));
-   if (!strcmp(arg,    "comp1")) return (ProcessCommand(ret, INPUT_COMPONENT_1));
-   if (!strcmp(arg,    "comp2")) return (ProcessCommand(ret, INPUT_COMPONENT_2));
-   if (!strcmp(arg,      "vga")) return (ProcessCommand(ret, INPUT_VGA));
-   if (!strcmp(arg,     "hdmi")) return (ProcessCommand(ret, INPUT_HDMI));
-
-   return (INVALID_ARGUMENT);
+ReadPowerStatus(Device *dev, char ret[]) {
+   return (SanyoSendCommand(dev, ret, READ_POWER_STATUS, REPLY_POWER));
 }
 
 int
-ExecScalerCommand(char ret[], const char *arg) {
-   if (!strcmp(arg,      "off")) return (ProcessCommand(ret, SCALE_NORMAL_THROUGH));
-   if (!strcmp(arg,   "normal")) return (ProcessCommand(ret, SCALE_NORMAL));
-   if (!strcmp(arg,     "zoom")) return (ProcessCommand(ret, SCALE_ZOOM));
-   if (!strcmp(arg,     "full")) return (ProcessCommand(ret, SCALE_FULL));
-   if (!strcmp(arg,    "wide1")) return (ProcessCommand(ret, SCALE_WIDE_1));
-   if (!strcmp(arg,    "wide2")) return (ProcessCommand(ret, SCALE_WIDE_2));
-   if (!strcmp(arg,   "strech")) return (ProcessCommand(ret, SCALE_FULL_THROUGH));
-   if (!strcmp(arg,  "caption")) return (ProcessCommand(ret, SCALE_CAPTION));
-
-   return (INVALID_ARGUMENT);
+ReadInputMode(Device *dev, char ret[]) {
+   return (SanyoSendCommand(dev, ret, READ_INPUT_MODE, REPLY_INPUT));
 }
 
 int
-ExecLampCommand(char ret[], const char *arg) {
-   if (!strcmp(arg,   "normal")) return (ProcessCommand(ret, LAMP_NORMAL));
-   if (!strcmp(arg,    "auto1")) return (ProcessCommand(ret, LAMP_AUTO_1));
-   if (!strcmp(arg,    "auto2")) return (ProcessCommand(ret, LAMP_AUTO_2));
-   if (!strcmp(arg,      "eco")) return (ProcessCommand(ret, LAMP_ECONOMY));
-
-   return (INVALID_ARGUMENT);
+ReadLampHours(Device *dev, char ret[]) {
+   return (SanyoSendCommand(dev, ret, READ_LAMP_HOURS, REPLY_HOURS));
 }
 
 int
-ExecColorCommand(char ret[], const char *arg) {
-   if (!strcmp(arg, "creative")) return (ProcessCommand(ret, COLOR_CREATIVE));
-   if (!strcmp(arg,   "cinema")) return (ProcessCommand(ret, COLOR_CINEMA));
-   if (!strcmp(arg,  "natural")) return (ProcessCommand(ret, COLOR_NATURAL));
-   if (!strcmp(arg,   "living")) return (ProcessCommand(ret, COLOR_LIVING));
-   if (!strcmp(arg,  "dynamic")) return (ProcessCommand(ret, COLOR_DYNAMIC));
-   if (!strcmp(arg, "powerful")) return (ProcessCommand(ret, COLOR_POWERFUL));
-   if (!strcmp(arg,    "vivid")) return (ProcessCommand(ret, COLOR_VIVID));
-   if (!strcmp(arg,    "user1")) return (ProcessCommand(ret, COLOR_USER_1));
-   if (!strcmp(arg,    "user2")) return (ProcessCommand(ret, COLOR_USER_2));
-   if (!strcmp(arg,    "user3")) return (ProcessCommand(ret, COLOR_USER_3));
-   if (!strcmp(arg,    "user4")) return (ProcessCommand(ret, COLOR_USER_4));
-
-   return (INVALID_ARGUMENT);
+ReadTempSensors(Device *dev, char ret[]) {
+   return (SanyoSendCommand(dev, ret, READ_TEMP_SENSORS, REPLY_TEXT));
 }
 
 int
-ExecMuteCommand(char ret[], const char *arg) {
-   if (!strcmp(arg,       "on")) return (ProcessCommand(ret, MUTE_ON));
-   if (!strcmp(arg,      "off")) return (ProcessCommand(ret, MUTE_OFF));
-
-   return (INVALID_ARGUMENT);
+ReadModelNumber(Device *dev, char ret[]) {
+   return (SanyoSendCommand(dev, ret, READ_MODEL_NUMBER, REPLY_TEXT));
 }
 
 int
-ExecGenericCommand(char ret[], const char *arg) {
+ExecGenericCommand(Device *dev, char ret[], const char *arg) {
    char cmd[5];
 
    snprintf(cmd, 5, "%3s\r", arg);
 
-   return (ProcessCommand(ret, cmd));
+   return (ProcessCommand(dev, ret, cmd));
 }
@@ -7,31 +7,75 @@
 #define WRITE_ERROR              4
 #define READ_TIMEOUT             5
 #define NOT_CONNECTED            6
+#define DEVICE_BUSY              7
+#define DEVICE_UNRESPONSIVE      8
 
-#define STRING_SIZE             32
+#define STRING_SIZE             64
 
-#include "serial.h"
+#define ROUND_TRIPS              5 // queries averaged for latency measurement
 
-extern Serial *sanyo_serial;
+#define SANYO_TIMEOUT         3000 // max time the projector takes to answer in ms
 
-int SanyoProbeDevice(const char *device);
+// power states as reported by CR0
+typedef enum {
+   SANYO_POWER_UNKNOWN          = -1,
+   SANYO_POWER_ON               =  0,
+   SANYO_POWER_SAVE             =  4,
+   SANYO_POWER_FAILURE          = 10,
+   SANYO_POWER_COOLING          = 20,
+   SANYO_POWER_COOLING_LAMP     = 21,
+   SANYO_POWER_COOLING_SAVE     = 24,
+   SANYO_POWER_COOLING_TEMP     = 28,
+   SANYO_POWER_COUNTDOWN        = 40,
+   SANYO_POWER_STANDBY          = 80,
+   SANYO_POWER_STANDBY_LAMP     = 81,
+   SANYO_POWER_STANDBY_TEMP     = 88
+} SanyoPower;
 
-int ReadPowerStatus(char ret[]);
-int ReadInputMode(char ret[]);
-int ReadLampHours(char ret[]);
-int ReadTempSensors(char ret[]);
-int ReadModelNumber(char ret[]);
+// input modes as reported by CR1
+typedef enum {
+   SANYO_INPUT_UNKNOWN          = -1,
+   SANYO_INPUT_COMPOSIT         =  0,
+   SANYO_INPUT_SVIDEO           =  1,
+   SANYO_INPUT_COMPONENT_1      =  2,
+   SANYO_INPUT_COMPONENT_2      =  3,
+   SANYO_INPUT_HDMI             =  4,
+   SANYO_INPUT_VGA              =  5,
+   SANYO_INPUT_SCART            =  6
+} SanyoInput;
 
-int ExecStatusRead(char ret[], const char *arg);
-int ExecPowerCommand(char ret[], const char *arg);
-int ExecInputCommand(char ret[], const char *arg);
-int ExecScalerCommand(char ret[], const char *arg);
-int ExecLampCommand(char ret[], const char *arg);
-int ExecColorCommand(char ret[], const char *arg);
-int ExecMuteCommand(char ret[], const char *arg);
-int ExecLogoCommand(char ret[], const char *arg);
-int ExecMenuCommand(char ret[], const char *arg);
-int ExecPressCommand(char ret[], const char *arg);
-int ExecGenericCommand(char ret[], const char *arg);
+#include "device.h"
+
+typedef struct SanyoStatus {
+   SanyoPower power;
+   SanyoInput input;
+   int lamp_hours;                    ///< -1 if unknown
+   char model[STRING_SIZE];
+   float temp[3];                     ///< temperature sensors in degree celsius
+   int temps;                         ///< number of valid sensor readings
+} SanyoStatus;
+
+int SanyoProbeDevice(Device *dev, const char *node);
+int SanyoRoundTrip(Device *dev, long *us);
+
+int SanyoSendCommand(Device *dev, char ret[], const char *wire, int reply);
+
+// both halves of SanyoSendCommand, for writing to several projectors at once
+int SanyoWriteCommand(Device *dev, const char *wire);
+int SanyoReadReply(Device *dev, char ret[], const char *wire, int reply, long start);
+
+// warming up or cooling down, the projector ignores everything but status reads
+int SanyoPowerBusy(const Device *dev);
+
+int SanyoReadStatus(Device *dev, SanyoStatus *status);
+int SanyoFormatStatus(char ret[], const SanyoStatus *status);
+
+int ReadPowerStatus(Device *dev, char ret[]);
+int ReadInputMode(Device *dev, char ret[]);
+int ReadLampHours(Device *dev, char ret[]);
+int ReadTempSensors(Device *dev, char ret[]);
+int ReadModelNumber(Device *dev, char ret[]);
+
+int ExecGenericCommand(Device *dev, char ret[], const char *arg);
 
 #endif // _Z4CTRL_SANYO_H_
@@ -1,25 +1,47 @@
 #define _BSD_SOURCE // CRTSCTS
 
+#include <linux/serial.h>
+#include <sys/ioctl.h>
 #include <dirent.h>
 #include <string.h>
+#include <stdio.h>
 #include <limits.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <poll.h>
+#include <time.h>
 
+#include "termios2.h"
+#include "config.h"
 #include "serial.h"
 
 // TODO check for NULL pointer
 // TODO check for serial->fd == -1
 
+long
+SerialTimestamp(void) {
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   return (now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+const char *
+SerialDirectory(void) {
+   // may point somewhere else, e.g. to the links of the emulator
+   return (ConfigString("SERIAL_DIR", SERIAL_BY_PATH));
+}
+
 int
 SerialListDevices(char *device[], unsigned int *number) {
    struct dirent **entry = NULL;
    unsigned int count = 0;
    char *file = NULL;
 
-   if (chdir("/dev/serial/by-path")) {
+   if (chdir(SerialDirectory())) {
       return (SERIAL_ERR_OPEN);
    }
 
@@ -41,6 +63,36 @@ SerialListDevices(char *device[], unsigned int *number) {
    return (SERIAL_OK);
 }
 
+int
+SerialLookupPath(const char *device, char *path, unsigned int size) {
+   char link[PATH_MAX], *file = NULL;
+   struct dirent *entry;
+   int err = SERIAL_ERR;
+   DIR *dir;
+
+   if (!(dir = opendir(SerialDirectory()))) {
+      return (SERIAL_ERR_OPEN);
+   }
+
+   while ((err) && (entry = readdir(dir))) {
+      if (entry->d_name[0] == '.') continue;
+
+      snprintf(link, sizeof (link), "%s/%s", SerialDirectory(), entry->d_name);
+
+      if ((file = realpath(link, NULL))) {
+         if (!strcmp(file, device) && (strlen(entry->d_name) < size)) {
+            strcpy(path, entry->d_name);
+            err = SERIAL_OK;
+         }
+         free(file);
+      }
+   }
+
+   closedir(dir);
+
+   return (err);
+}
+
 Serial *
 SerialOpen(const char *device) {
    int fd = -1;
@@ -54,7 +106,7 @@ SerialOpen(const char *device) {
 
    memset(serial, 0, sizeof (Serial));
    serial->fd = fd;
-   serial->device = device;
+   serial->device = strdup(device);
 
    return (serial);
 }
@@ -63,6 +115,7 @@ int
 SerialClose(Serial *serial) {
    close(serial->fd);
 
+   free((char *)serial->device);
    free(serial);
 
    return (SERIAL_OK);
@@ -72,9 +125,40 @@ int
 SerialFlush(Serial *serial) {
    tcflush(serial->fd, TCIOFLUSH);
 
+   // drop everything that was read ahead as well
+   serial->rx_length = 0;
+
    return (SERIAL_OK);
 }
 
+int
+SerialSetLowLatency(Serial *serial, int timer_ms) {
+   struct serial_struct info;
+   char path[PATH_MAX];
+   const char *name;
+   int err = SERIAL_ERR;
+   FILE *file;
+
+   // ask the driver to push received bytes up without delay
+   if (!ioctl(serial->fd, TIOCGSERIAL, &info)) {
+      info.flags |= ASYNC_LOW_LATENCY;
+
+      if (!ioctl(serial->fd, TIOCSSERIAL, &info)) err = SERIAL_OK;
+   }
+
+   // usb adapters like the FTDI collect bytes for up to 16 ms by default
+   name = (name = strrchr(serial->device, '/')) ? name + 1 : serial->device;
+
+   snprintf(path, sizeof (path), "/sys/class/tty/%s/device/latency_timer", name);
+
+   if ((access(path, W_OK) == 0) && (file = fopen(path, "w"))) {
+      if (fprintf(file, "%i", timer_ms) > 0) err = SERIAL_OK;
+      if (fclose(file)) err = SERIAL_ERR;
+   }
+
+   return (err);
+}
+
 int
 SerialSetTimeout(Serial *serial, int ms) {
    if (ms < 0) {
@@ -92,7 +176,7 @@ SerialSetTimeout(Serial *serial, int ms) {
 
 int
 SerialInit(Serial *serial, int baud, const char *format, int rtscts) {
-   int cflags = CLOCAL | CREAD;
+   int cflags = CLOCAL | CREAD, custom = 0;
 
    if ((!format) || (strlen(format) != 3)) {
       return (SERIAL_ERR_INIT);
@@ -132,7 +216,11 @@ SerialInit(Serial *serial, int baud, const char *format, int rtscts) {
       case   4800: cflags |= B4800;   break;
       case   2400: cflags |= B2400;   break;
       case    300: cflags |= B300;    break;
-      default: return (SERIAL_ERR_INIT);
+      default:
+         // any other rate is set through termios2 below
+         if (baud <= 0) return (SERIAL_ERR_INIT);
+         cflags |= B38400; custom = 1;
+      break;
    }
 
    // handshake
@@ -142,10 +230,24 @@ SerialInit(Serial *serial, int baud, const char *format, int rtscts) {
 
    // clear struct and set port parameters
    memset(&serial->settings, 0, sizeof (serial->settings));
-   serial->settings.c_cflag = cflags;
+   // no HUPCL, DTR stays up on close and the next open does not reset an arduino
+   serial->settings.c_cflag = cflags & ~HUPCL;
    serial->settings.c_iflag = IGNPAR;
 
    SerialSetTimeout(serial, 0);
+
+   if (custom) {
+      if (Termios2SetSpeed(serial->fd, baud)) {
+         return (SERIAL_ERR_INIT);
+      }
+
+      // read back the BOTHER speed bits, so that later calls to
+      // tcsetattr() do not fall back to the placeholder rate
+      tcgetattr(serial->fd, &serial->settings);
+   }
+
+   serial->baud = baud;
+
    SerialFlush(serial);
 
    return (0);
@@ -205,3 +307,63 @@ SerialReceiveBuffer(Serial *serial, void *buf, unsigned int *len, int timeout) {
 
    return (SERIAL_OK);
 }
+
+int
+SerialReceiveFrame(Serial *serial, void *buf, unsigned int cap, int delimiter, int deadline_ms) {
+   long start = SerialTimestamp();
+   unsigned char *end;
+   unsigned int length;
+   struct pollfd pfd;
+   int remaining, received;
+
+   pfd.fd = serial->fd;
+   pfd.events = POLLIN;
+
+   for (;;) {
+      // deliver the frame as soon as the delimiter is in the read-ahead buffer
+      if ((end = memchr(serial->rx_buffer, delimiter, serial->rx_length))) {
+         length = end - serial->rx_buffer + 1;
+
+         memcpy(buf, serial->rx_buffer, (length < cap) ? length : cap);
+
+         serial->rx_length -= length;
+         memmove(serial->rx_buffer, end + 1, serial->rx_length);
+
+         return ((length < cap) ? length : cap);
+      }
+
+      if (serial->rx_length == SERIAL_RX_SIZE) {
+         // no delimiter within a full buffer, this is garbage
+         serial->rx_length = 0;
+
+         return (SERIAL_ERR_READ);
+      }
+
+      if ((remaining = deadline_ms - (SerialTimestamp() - start)) < 0) {
+         remaining = 0;
+      }
+
+      // wait for more data, keeping partial frames in the buffer
+      if ((received = poll(&pfd, 1, remaining)) < 0) {
+         if (errno == EINTR) continue;
+
+         return (SERIAL_ERR_READ);
+      } else if (received == 0) {
+         return (SERIAL_ERR_TIMEOUT);
+      }
+
+      received = read(serial->fd, serial->rx_buffer + serial->rx_length,
+                      SERIAL_RX_SIZE - serial->rx_length);
+
+      if (received < 0) {
+         if ((errno == EINTR) || (errno == EAGAIN)) continue;
+
+         return (SERIAL_ERR_READ);
+      } else if (received == 0) {
+         // readable but no data, the device is gone
+         return (SERIAL_ERR_READ);
+      }
+
+      serial->rx_length += received;
+   }
+}
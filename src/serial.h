@@ -11,21 +11,35 @@
 #define SERIAL_ERR_INIT         -5 ///< parameter mismatch error
 #define SERIAL_ERR_TIMEOUT      -6 ///< read did not complete in time
 
+#define SERIAL_BY_PATH  "/dev/serial/by-path" ///< persistent device names
+
+#define SERIAL_RX_SIZE         256 ///< size of the per port read-ahead buffer
+
 typedef struct Serial {
    int fd;
    struct termios settings;
    const char *device;
+   int baud;                                ///< current line speed
+   unsigned char rx_buffer[SERIAL_RX_SIZE]; ///< bytes read but not yet consumed
+   unsigned int rx_length;                  ///< number of bytes in rx_buffer
 } Serial;
 
+long SerialTimestamp(void);
+
+const char *SerialDirectory(void);
+
 int SerialListDevices(char *device[], unsigned int *number);
+int SerialLookupPath(const char *device, char *path, unsigned int size);
 
 Serial *SerialOpen(const char *device);
 
 int SerialClose(Serial *serial);
 int SerialInit(Serial *serial, int baud, const char *format, int rtscts);
 int SerialFlush(Serial *serial);
+int SerialSetLowLatency(Serial *serial, int timer_ms);
 int SerialSetTimeout(Serial *serial, int ms);
 int SerialSendBuffer(Serial *serial, const void *buf, unsigned int len);
 int SerialReceiveBuffer(Serial *serial, void *buf, unsigned int *len, int timeout);
+int SerialReceiveFrame(Serial *serial, void *buf, unsigned int cap, int delimiter, int deadline_ms);
 
 #endif // _Z4CTRL_SERIAL_H_
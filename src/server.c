@@ -1,3 +1,6 @@
+#define _POSIX_C_SOURCE 200112L // pthread_rwlock_t
+
+#include <pthread.h>
 #include <string.h>
 #include <syslog.h>
 #include <stdlib.h>
@@ -7,8 +10,17 @@
 
 #include "sanyo.h"
 #include "onkyo.h"
+#include "hotplug.h"
+#include "dispatch.h"
+#include "device.h"
+#include "cache.h"
+#include "queue.h"
+#include "server.h"
 #include "snl.h"
 
+// "#42 " in front, an error string in between and the joined responses
+#define REPLY_SIZE (SERVER_ID_SIZE + 64 + BATCH_RESULT_SIZE)
+
 static int shutdown = 0;
 
 static void
@@ -18,70 +30,445 @@ quit(int sig) {
    }
 }
 
+// one executor per device slot
+static Queue *queue[DEVICE_MAX];
+
+// groups lock their members themselves, so they share one executor
+static Queue *group_queue;
+
+// replies go out on the listening socket, even while it shuts down
+static int reply_fd = -1;
+
+typedef struct Connection {
+   snl_socket_t *skt;                 ///< framed stream the replies go back on
+   pthread_mutex_t lock;              ///< executors must not interleave their frames
+   unsigned int refs;                 ///< the open stream plus every pending request
+   struct Connection *next;
+} Connection;
+
+typedef struct Client {
+   unsigned int ip;                   ///< sender of the request in host byte order
+   unsigned short port;               ///< sender port in network byte order
+   char id[SERVER_ID_SIZE];           ///< e.g. "#42", empty if the client sent none
+   Connection *conn;                  ///< stream the request came in on, NULL for UDP
+} Client;
+
+typedef struct Recent {
+   unsigned int ip;                   ///< client of the request in host byte order
+   unsigned short port;               ///< client port in network byte order
+   char id[SERVER_ID_SIZE];           ///< empty for unused slots
+   char reply[REPLY_SIZE];            ///< last reply sent, "queued" or the result
+   int length;                        ///< 0 while the request was not answered yet
+} Recent;
+
+// UDP requests seen lately, a retry is answered from here instead of run again
+static pthread_mutex_t recent_lock = PTHREAD_MUTEX_INITIALIZER;
+static Recent recent[SERVER_RECENT];
+static unsigned int recent_next = 0;
+
+// open control connections, guarded by connection_lock
+static pthread_mutex_t connection_lock = PTHREAD_MUTEX_INITIALIZER;
+static Connection *connections = NULL;
+
+// network callbacks only submit requests while they hold intake_lock
+static pthread_rwlock_t intake_lock = PTHREAD_RWLOCK_INITIALIZER;
+static int stopping = 0;
+
+static void
+ConnectionRelease(Connection *conn) {
+   snl_socket_t *skt = conn->skt;
+   Connection **ptr;
+   int last;
+
+   pthread_mutex_lock(&connection_lock);
+
+   if ((last = !--conn->refs)) {
+      for (ptr = &connections; *ptr; ptr = &(*ptr)->next) {
+         if (*ptr == conn) {
+            *ptr = conn->next;
+            break;
+         }
+      }
+   }
+
+   pthread_mutex_unlock(&connection_lock);
+
+   if (!last) return;
+
+   pthread_mutex_destroy(&conn->lock);
+   free(conn);
+
+   // replies of requests still pending needed the socket until now
+   snl_socket_delete(skt);
+}
+
+static const char *
+ErrorString(int err) {
+   switch (err) {
+      case UNKNOWN_COMMAND:     return ("unknown command");
+      case INVALID_ARGUMENT:    return ("invalid argument");
+      case WRITE_ERROR:         return ("serial write error");
+      case READ_TIMEOUT:        return ("serial read timeout");
+      case OPEN_FAILED:         return ("serial device open failed");
+      case NOT_CONNECTED:       return ("device not connected");
+      case DEVICE_BUSY:         return ("device busy");
+      case DEVICE_UNRESPONSIVE: return ("device not responding");
+   }
+
+   return (NULL);
+}
+
+static Recent *
+RecentFind(const Client *client) {
+   for (int i=0; i<SERVER_RECENT; i++) {
+      if ((recent[i].ip == client->ip) && (recent[i].port == client->port) &&
+          !strcmp(recent[i].id, client->id)) {
+         return (&recent[i]);
+      }
+   }
+
+   return (NULL);
+}
+
+static int
+RecentCheck(const Client *client) {
+   char reply[REPLY_SIZE];
+   Recent *entry;
+   int len = 0;
+
+   pthread_mutex_lock(&recent_lock);
+
+   if ((entry = RecentFind(client))) {
+      memcpy(reply, entry->reply, entry->length);
+      len = entry->length;
+   } else {
+      // the oldest request is forgotten
+      entry = &recent[recent_next++ % SERVER_RECENT];
+
+      entry->ip = client->ip;
+      entry->port = client->port;
+      entry->length = 0;
+      strcpy(entry->id, client->id);
+
+      entry = NULL;
+   }
+
+   pthread_mutex_unlock(&recent_lock);
+
+   // a retry of a request still running gets its reply once it is done
+   if (len && snl_sendto(reply_fd, reply, len, client->ip, client->port)) {
+      syslog(LOG_ERR, "failed to send reply");
+   }
+
+   return (entry != NULL);
+}
+
+static void
+RecentStore(const Client *client, const char *reply, int len) {
+   Recent *entry;
+
+   pthread_mutex_lock(&recent_lock);
+
+   if ((entry = RecentFind(client))) {
+      memcpy(entry->reply, reply, len);
+      entry->length = len;
+   }
+
+   pthread_mutex_unlock(&recent_lock);
+}
+
+static void
+Reply(Request *req, const char *status) {
+   char reply[REPLY_SIZE];
+   Client *client = req->user_data;
+   const char *error;
+   int len, err;
+
+   if (!client) return;
+
+   error = (req->err) ? ErrorString(req->err) : NULL;
+
+   // "#42 0 power on", "#42 5 serial read timeout" or "#42 queued"
+   len = snprintf(reply, sizeof (reply), "%s%s%s", client->id, (client->id[0]) ? " " : "", status);
+
+   if (error) {
+      len += snprintf(reply + len, sizeof (reply) - len, " %s", error);
+   }
+
+   if (req->ret[0] && (len < sizeof (reply))) {
+      len += snprintf(reply + len, sizeof (reply) - len, "%s%s", (error) ? ": " : " ", req->ret);
+   }
+
+   if (len >= sizeof (reply)) len = sizeof (reply) - 1;
+
+   if (client->conn) {
+      // any executor may answer, one frame must go out before the next,
+      // a client that stops reading is dropped instead of stalling the queue
+      pthread_mutex_lock(&client->conn->lock);
+      err = snl_post(client->conn->skt, reply, len);
+      pthread_mutex_unlock(&client->conn->lock);
+   } else {
+      if (client->id[0]) RecentStore(client, reply, len);
+
+      err = snl_sendto(reply_fd, reply, len, client->ip, client->port);
+   }
+
+   if (err) {
+      syslog(LOG_ERR, "failed to send reply");
+   }
+}
+
+static void
+RequestDone(Request *req) {
+   Client *client = req->user_data;
+   char status[16];
+   const char *error;
+
+   if ((error = ErrorString(req->err))) {
+      syslog(LOG_ERR, "%s", error);
+   } else {
+      syslog(LOG_DEBUG, "response: %s", req->ret);
+   }
+
+   snprintf(status, sizeof (status), "%i", req->err);
+   Reply(req, status);
+
+   if (req->err && (req->count > 1)) {
+      syslog(LOG_ERR, "batch stopped at command %u of %u", req->executed + 1, req->count);
+   }
+
+   if (req->err && req->ret[0]) {
+      // some members of a group may still have answered
+      syslog(LOG_ERR, "response: %s", req->ret);
+   }
+
+   if (client && client->conn) {
+      ConnectionRelease(client->conn);
+   }
+
+   free(client);
+   free(req);
+}
+
+static void
+RequestQueued(Request *req) {
+   syslog(LOG_INFO, "queued until %s is ready: %s %s", (req->target[0]) ? req->target :
+          "the projector", req->command[req->executed].cmd, req->command[req->executed].arg);
+
+   // the client keeps waiting instead of retrying
+   Reply(req, "queued");
+}
+
+static void
+GroupDone(Request *req) {
+   for (int i=0; i<req->members; i++) {
+      CacheInvalidate(req->member[i], req->command[0].cmd);
+   }
+
+   RequestDone(req);
+}
+
+static void
+Receive(const snl_datagram_t *dgram, Connection *conn) {
+   const char *data = dgram->data;
+   Client *client;
+   Request *req;
+   Device *dev;
+   size_t len;
+
+   if (!(req = malloc(sizeof (Request)))) {
+      return;
+   }
+
+   if (!(client = malloc(sizeof (Client)))) {
+      free(req);
+      return;
+   }
+
+   memset(req, 0, sizeof (Request));
+   req->queued = RequestQueued;
+   req->done = RequestDone;
+   req->user_data = client;
+
+   client->ip = dgram->client_ip;
+   client->port = dgram->client_port;
+   client->id[0] = '\0';
+   client->conn = conn;
+
+   // the reply may be sent long after the stream is closed
+   if (conn) {
+      pthread_mutex_lock(&connection_lock);
+      conn->refs++;
+      pthread_mutex_unlock(&connection_lock);
+   }
+
+   // "#42 power on" gets a reply the client can match
+   if (*data == '#') {
+      len = strcspn(data, " \t");
+
+      if (len >= SERVER_ID_SIZE) {
+         req->err = INVALID_ARGUMENT;
+         RequestDone(req);
+         return;
+      }
+
+      memcpy(client->id, data, len);
+      client->id[len] = '\0';
+
+      data += len;
+      data += strspn(data, " \t");
+
+      // a lost reply must not make the projector run the command twice
+      if (!conn && RecentCheck(client)) {
+         free(client);
+         free(req);
+         return;
+      }
+   }
+
+   syslog(LOG_DEBUG, "received: %s", data);
+
+   if ((req->err = RequestParse(req, data))) {
+      RequestDone(req);
+      return;
+   }
+
+   if ((req->err = RequestRoute(req, &dev))) {
+      RequestDone(req);
+      return;
+   }
+
+   if (req->members) {
+      req->done = GroupDone;
+
+      if ((req->err = QueueSubmit(group_queue, req))) {
+         RequestDone(req);
+      }
+
+      return;
+   }
+
+   // status reads are answered from memory while the cache is fresh
+   if ((req->count == 1) && !CacheRead(dev, req->ret, req->command[0].cmd, req->command[0].arg)) {
+      RequestDone(req);
+      return;
+   }
+
+   // devices never wait for each other, each has its own executor
+   if ((req->err = QueueSubmit(queue[DeviceIndex(dev)], req))) {
+      RequestDone(req);
+   }
+}
+
 static void
 event_callback(snl_socket_t *skt) {
-   char *data, cmd[32], arg[32], ret[STRING_SIZE];
-   int err = UNKNOWN_COMMAND;
+   // a burst of datagrams arrives in one batch
+   if (skt->event_code == SNL_EVENT_BATCH) {
+      for (int i=0; i<skt->batch_length; i++) {
+         Receive(&skt->batch[i], NULL);
+      }
+   }
+}
 
-   if (skt->event_code == SNL_EVENT_RECEIVE) {
-      data = (char *)skt->data_buffer;
-      data[skt->data_length] = '\0';
+static void
+connection_callback(snl_socket_t *skt) {
+   char data[SERVER_BATCH_SIZE + 1];
+   Connection *conn = skt->user_data;
+   snl_datagram_t frame;
+
+   pthread_rwlock_rdlock(&intake_lock);
+
+   // after shutdown began, the server closes all connections itself
+   if (stopping) goto done;
 
-      // remove last command from buffers
-      memset(cmd, 0, 32);
-      memset(arg, 0, 32);
-
-      memset(ret, 0, STRING_SIZE);
-
-      sscanf(data, "%31s %31s", cmd, arg);
-
-      syslog(LOG_DEBUG, "received: %s %s", cmd, arg);
-
-      if (cmd[0] == 'C') err = ExecGenericCommand(ret, cmd);
-      else if (!strcmp(cmd,  "power")) err = ExecPowerCommand(ret, arg);
-      else if (!strcmp(cmd,  "input")) err = ExecInputCommand(ret, arg);
-      else if (!strcmp(cmd, "scaler")) err = ExecScalerCommand(ret, arg);
-      else if (!strcmp(cmd,   "lamp")) err = ExecLampCommand(ret, arg);
-      else if (!strcmp(cmd,  "color")) err = ExecColorCommand(ret, arg);
-      else if (!strcmp(cmd,   "menu")) err = ExecMenuCommand(ret, arg);
-      else if (!strcmp(cmd,   "mute")) err = ExecMuteCommand(ret, arg);
-      else if (!strcmp(cmd,  "press")) err = ExecPressCommand(ret, arg);
-      else if (!strcmp(cmd,   "logo")) err = ExecLogoCommand(ret, arg);
-      else if (!strcmp(cmd, "status")) err = ExecStatusRead(ret, arg);
-      else if (!strcmp(cmd,  "model")) err = ReadModelNumber(ret);
-      else if (!strcmp(cmd,  "onkyo")) err = OnkyoExecCommand(ret, arg);
-
-      switch (err) {
-         case UNKNOWN_COMMAND:
-            syslog(LOG_ERR, "unknown command");
-         break;
-
-         case INVALID_ARGUMENT:
-            syslog(LOG_ERR, "invalid argument");
-         break;
-
-         case WRITE_ERROR:
-            syslog(LOG_ERR, "serial write error");
-         break;
-
-         case READ_TIMEOUT:
-            syslog(LOG_ERR, "serial read timeout");
-         break;
-
-         case OPEN_FAILED:
-            syslog(LOG_ERR, "serial device open failed");
-         break;
-
-         default:
-            syslog(LOG_DEBUG, "response: %s", ret);
-         break;
+   if (skt->event_code == SNL_EVENT_ERROR) {
+      // peer hung up, pending requests keep the connection until answered
+      ConnectionRelease(conn);
+   } else if (skt->event_code == SNL_EVENT_RECEIVE) {
+      if (skt->data_length > SERVER_BATCH_SIZE) {
+         syslog(LOG_ERR, "dropped request of %u bytes", skt->data_length);
+         goto done;
       }
+
+      // frames are not terminated on the wire
+      memcpy(data, skt->data_buffer, skt->data_length);
+      data[skt->data_length] = '\0';
+
+      memset(&frame, 0, sizeof (frame));
+      frame.data = data;
+      frame.length = skt->data_length;
+
+      Receive(&frame, conn);
+   }
+
+done:
+
+   pthread_rwlock_unlock(&intake_lock);
+}
+
+static void
+accept_callback(snl_socket_t *skt) {
+   Connection *conn;
+
+   if (skt->event_code != SNL_EVENT_ACCEPT) return;
+
+   pthread_rwlock_rdlock(&intake_lock);
+
+   if (stopping || !(conn = calloc(1, sizeof (Connection)))) {
+      close(skt->client_fd);
+      goto done;
+   }
+
+   if (!(conn->skt = snl_socket_new(SNL_PROTO_MSG, connection_callback, conn))) {
+      close(skt->client_fd);
+      free(conn);
+      goto done;
+   }
+
+   conn->skt->file_descriptor = skt->client_fd;
+   conn->refs = 1;
+
+   pthread_mutex_init(&conn->lock, NULL);
+
+   // listed first, the stream may deliver requests right away
+   pthread_mutex_lock(&connection_lock);
+   conn->next = connections;
+   connections = conn;
+   pthread_mutex_unlock(&connection_lock);
+
+   if (snl_accept(conn->skt)) {
+      syslog(LOG_ERR, "failed to accept connection");
+      ConnectionRelease(conn);
+   }
+
+done:
+
+   pthread_rwlock_unlock(&intake_lock);
+}
+
+static void
+LogStatistics(void) {
+   Device *dev;
+
+   for (int i=0; i<DEVICE_MAX; i++) {
+      dev = DeviceSlot(i);
+
+      if (dev->protocol < 0) continue;
+
+      syslog(LOG_INFO, "%s: %lu commands, %lu errors, %lu timeouts, %lu elided, %lu stale, %lu rejected",
+             dev->name, dev->stats.commands, dev->stats.errors, dev->stats.timeouts,
+             dev->stats.elided, dev->stats.stale, dev->stats.rejected);
+
+      syslog(LOG_INFO, "%s: timeouts %i ms read, %i ms set, %i ms power", dev->name,
+             DeviceTimeout(dev, DEVICE_CLASS_READ), DeviceTimeout(dev, DEVICE_CLASS_SET),
+             DeviceTimeout(dev, DEVICE_CLASS_POWER));
    }
 }
 
 int
 ServerNetworkStart(void) {
-   snl_socket_t *server = NULL;
+   snl_socket_t *server = NULL, *stream = NULL;
+   Connection *conn;
 
    snl_init();
 
@@ -91,24 +478,101 @@ ServerNetworkStart(void) {
    signal(SIGQUIT, quit);
    signal(SIGHUP,  quit);
 
+   // one executor per device, network threads only enqueue
+   for (int i=0; i<DEVICE_MAX; i++) {
+      if (!(queue[i] = QueueNew(CacheExecute, DeviceSlot(i)))) {
+         syslog(LOG_ERR, "failed to start device executors");
+
+         while (i--) QueueDelete(queue[i]);
+
+         return (-1);
+      }
+   }
+
+   if (!(group_queue = QueueNew(CacheExecute, NULL))) {
+      syslog(LOG_ERR, "failed to start group executor");
+
+      for (int i=0; i<DEVICE_MAX; i++) QueueDelete(queue[i]);
+
+      return (-1);
+   }
+
    server = snl_socket_new(SNL_PROTO_UDP, event_callback, NULL);
 
-   if (snl_listen(server, 1541)) {
+   if (snl_batch(server, SERVER_BATCH_SLOTS, SERVER_BATCH_SIZE) ||
+       snl_listen(server, SERVER_PORT)) {
       syslog(LOG_ERR, "failed to start server");
 
       goto cleanup;
    }
 
-   syslog(LOG_INFO, "UDP server started on port 1541");
+   reply_fd = dup(server->file_descriptor);
+
+   syslog(LOG_INFO, "UDP server started on port %i", SERVER_PORT);
+
+   // control connections share a few threads instead of one each
+   if (snl_pool(SERVER_POOL_THREADS) || snl_backlog(SERVER_BACKLOG) ||
+       snl_frame_max(SERVER_BATCH_SIZE)) {
+      syslog(LOG_ERR, "failed to start connection pool");
+   } else {
+      stream = snl_socket_new(SNL_PROTO_MSG, accept_callback, NULL);
+
+      if (snl_listen(stream, SERVER_PORT)) {
+         syslog(LOG_ERR, "failed to start TCP server");
+      } else {
+         syslog(LOG_INFO, "TCP server started on port %i", SERVER_PORT);
+      }
+   }
+
+   // keep the projector status in memory for polling clients
+   if (CacheStart(queue)) {
+      syslog(LOG_ERR, "failed to start status poller");
+   }
+
+   // re-attach devices that get plugged in while we are running
+   if (HotplugStart()) {
+      syslog(LOG_ERR, "failed to start hotplug monitor");
+   }
 
    while (!shutdown) {
       sleep(1);
    }
 
+   HotplugStop();
+   CacheStop();
+
 cleanup:
 
-   snl_disconnect(server);
+   // nothing new comes in, pending requests are still answered
    snl_socket_delete(server);
+   if (stream) snl_socket_delete(stream);
+
+   pthread_rwlock_wrlock(&intake_lock);
+   stopping = 1;
+   pthread_rwlock_unlock(&intake_lock);
+
+   QueueDelete(group_queue);
+
+   for (int i=0; i<DEVICE_MAX; i++) {
+      QueueDelete(queue[i]);
+   }
+
+   // every request is answered, connections only hold their own reference
+   for (;;) {
+      pthread_mutex_lock(&connection_lock);
+      conn = connections;
+      pthread_mutex_unlock(&connection_lock);
+
+      if (!conn) break;
+
+      ConnectionRelease(conn);
+   }
+
+   snl_pool(0);
+
+   if (reply_fd >= 0) close(reply_fd);
+
+   LogStatistics();
 
    syslog(LOG_INFO, "terminating");
    closelog();
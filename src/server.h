@@ -1,6 +1,17 @@
 #ifndef _Z4CTRL_SERVER_H_
 #define _Z4CTRL_SERVER_H_
 
+#define SERVER_PORT           1541 // UDP datagrams and TCP connections alike
+
+#define SERVER_BATCH_SLOTS      32 // max number of datagrams read with one syscall
+#define SERVER_BATCH_SIZE     1024 // longest request accepted in bytes
+
+#define SERVER_ID_SIZE          16 // longest request id, e.g. "#1234-1"
+#define SERVER_RECENT           64 // UDP requests remembered to answer retries
+
+#define SERVER_POOL_THREADS      2 // threads serving all TCP connections
+#define SERVER_BACKLOG          16 // connections waiting to be accepted
+
 int ServerNetworkStart(void);
 
 #endif // _Z4CTRL_SERVER_H_
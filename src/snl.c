@@ -17,7 +17,7 @@
    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
-#define _POSIX_C_SOURCE   199309L // for nananosleep
+#define _GNU_SOURCE // recvmmsg()
 
 #include <errno.h>       // errno, EINTR
 #include <fcntl.h>       // F_GETFL, F_SETFL, fcntl()
@@ -25,13 +25,17 @@
 #include <string.h>      // memset(), memcpy(), strlen()
 #include <signal.h>      // signal(), SIG_IGN, SIGPIPE
 #include <stdlib.h>      // malloc(), free()
+#include <stdint.h>      // uint64_t
+#include <limits.h>      // UINT_MAX
 #include <pthread.h>     // pthread_*()
 #include <sys/socket.h>  // socket(), bind(), listen(), accept(), shutdown()
+#include <sys/uio.h>     // struct iovec
+#include <sys/eventfd.h> // eventfd()
+#include <sys/epoll.h>   // epoll_create1(), epoll_ctl(), epoll_wait()
 #include <netdb.h>       // gethostbyname()
 #include <netinet/tcp.h> // TCP_NODELAY
 #include <netinet/in.h>  // struct sockaddr_in
 #include <arpa/inet.h>   // htons(), htonl(), ntohl()
-#include <time.h>        // nanosleep()
 #include <sys/time.h>    // struct timeval
 
 #include "snl.h"
@@ -42,14 +46,35 @@
 #define INITIAL_PAYLOAD_SIZE 1<<12 //  4KB
 #define PACKED_PAYLOAD_SIZE  1<<10 //  1KB
 #define UDP_PAYLOAD_SIZE     1<<16 // 64KB
+#define UDP_BATCH_MAX         1024 // recvmmsg() limit (UIO_MAXIOV)
+#define POOL_EVENTS             64 // max events handled per pool wakeup
 
 static int send_timeout       = 3; // socket write timeout in seconds
 static int connect_timeout    = 5; // connect timeout in seconds
 static int connection_backlog = 3; // max queue length for pending connections
 
+static unsigned int frame_max = 0; // longest MSG datagram accepted, 0 for no limit
+
 static pthread_attr_t thread_attr;
 
+typedef struct snl_pool_t {
+   pthread_t tid;
+   int epoll_fd;
+   int event_fd;                       // wakes the thread for deletes and stop
+   int stop;
+   snl_socket_t *graveyard;            // deleted sockets, freed between wakeups
+   pthread_mutex_t lock;
+} snl_pool_t;
+
+static snl_pool_t *pool;
+static unsigned int pool_size;
+static unsigned int pool_next;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static void *worker_thread(void *arg);
+static void worker_accept(snl_socket_t *skt, int fd);
+static int pool_register(snl_socket_t *skt);
 
 enum {
    WORKER_THREAD_UNKNOWN,
@@ -59,14 +84,268 @@ enum {
    WORKER_THREAD_LISTEN
 };
 
+static int
+worker_set_type(snl_socket_t *skt, int type) {
+   pthread_mutex_lock(&skt->worker_lock);
+   skt->worker_type = type;
+   pthread_cond_signal(&skt->worker_cond);
+   pthread_mutex_unlock(&skt->worker_lock);
+
+   // pooled sockets have no worker waiting for the type
+   if (skt->pool) return (pool_register(skt));
+
+   return (SNL_ERROR_OK);
+}
+
+static void
+worker_wakeup(snl_socket_t *skt) {
+   uint64_t one = 1;
+
+   pthread_mutex_lock(&skt->worker_lock);
+   skt->worker_stop = 1;
+   pthread_cond_signal(&skt->worker_cond);
+   pthread_mutex_unlock(&skt->worker_lock);
+
+   // interrupt a worker blocking in epoll_wait()
+   if (write(skt->worker_event, &one, sizeof (one)) != sizeof (one)) return;
+}
+
+static void
+worker_free(snl_socket_t *skt) {
+   close(skt->worker_event);
+
+   pthread_cond_destroy(&skt->worker_cond);
+   pthread_mutex_destroy(&skt->worker_lock);
+
+   free(skt->data_buffer);
+   free(skt->batch);
+   free(skt);
+}
+
+static void
+pool_wakeup(snl_pool_t *p) {
+   uint64_t one = 1;
+
+   if (write(p->event_fd, &one, sizeof (one)) != sizeof (one)) return;
+}
+
+static int
+pool_register(snl_socket_t *skt) {
+   snl_pool_t *p = skt->pool;
+   struct epoll_event ev;
+
+   if (skt->worker_type == WORKER_THREAD_READ) {
+      skt->buffer_length = INITIAL_PAYLOAD_SIZE;
+      skt->frame_received = 0;
+
+      if (!(skt->data_buffer = realloc(skt->data_buffer, skt->buffer_length))) {
+         return (SNL_ERROR_BUFFER);
+      }
+   }
+
+   memset(&ev, 0, sizeof (ev));
+   ev.events = EPOLLIN;
+   ev.data.ptr = skt;
+
+   if (epoll_ctl(p->epoll_fd, EPOLL_CTL_ADD, skt->file_descriptor, &ev)) {
+      return (SNL_ERROR_THREAD);
+   }
+
+   return (SNL_ERROR_OK);
+}
+
+static void
+pool_unregister(snl_socket_t *skt, int error) {
+   snl_pool_t *p = skt->pool;
+
+   epoll_ctl(p->epoll_fd, EPOLL_CTL_DEL, skt->file_descriptor, NULL);
+
+   skt->worker_type = WORKER_THREAD_UNKNOWN;
+
+   if (error && !skt->worker_stop) {
+      skt->error_code = error;
+      skt->event_code = SNL_EVENT_ERROR;
+      skt->event_callback(skt);
+   }
+}
+
+static int
+frame_buffer(snl_socket_t *skt, unsigned int length) {
+   unsigned int size;
+   void *buffer;
+
+   // the length comes from the peer, nothing is allocated before it is checked
+   if (frame_max && (length > frame_max)) return (SNL_ERROR_FRAME);
+
+   if (length <= skt->buffer_length) return (SNL_ERROR_OK);
+
+   // leave room to grow, without wrapping around or passing the limit
+   size = (length > UINT_MAX / 2) ? length : length * 2;
+   if (frame_max && (size > frame_max)) size = frame_max;
+
+   if (!(buffer = realloc(skt->data_buffer, size))) return (SNL_ERROR_BUFFER);
+
+   skt->data_buffer = buffer;
+   skt->buffer_length = size;
+
+   return (SNL_ERROR_OK);
+}
+
+static int
+pool_receive(snl_socket_t *skt, void *buf, unsigned int len) {
+   int received;
+
+   // the socket stays blocking for snl_send(), only reads must not block
+   while ((received = recv(skt->file_descriptor, buf, len, MSG_DONTWAIT)) < 0) {
+      if (errno == EINTR) continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return (0);
+
+      return (-SNL_ERROR_RECEIVE);
+   }
+
+   return ((received) ? received : -SNL_ERROR_CLOSED);
+}
+
+static int
+pool_read(snl_socket_t *skt) {
+   unsigned int length, offset, remaining;
+   int received, error;
+   char *ptr;
+
+   if (skt->protocol == SNL_PROTO_TCP) {
+      // read whatever is there
+      if ((received = pool_receive(skt, skt->data_buffer, skt->buffer_length)) <= 0) {
+         return (-received);
+      }
+
+      skt->xfer_rcvd += received;
+
+      skt->error_code = SNL_ERROR_OK;
+      skt->event_code = SNL_EVENT_RECEIVE;
+      skt->data_length = received;
+
+      skt->event_callback(skt);
+
+      return (SNL_ERROR_OK);
+   }
+
+   // frames arrive in pieces, continue where the last wakeup stopped
+   while (!skt->worker_stop) {
+      if (skt->frame_received < sizeof (length)) {
+         // read length of next datagram
+         ptr = (char *)&skt->frame_header + skt->frame_received;
+         remaining = sizeof (length) - skt->frame_received;
+      } else {
+         // read datagram
+         offset = skt->frame_received - sizeof (length);
+         ptr = (char *)skt->data_buffer + offset;
+         remaining = ntohl(skt->frame_header) - offset;
+      }
+
+      if (remaining) {
+         if ((received = pool_receive(skt, ptr, remaining)) <= 0) return (-received);
+
+         skt->frame_received += received;
+      }
+
+      if (skt->frame_received < sizeof (length)) continue;
+
+      // convert back to host byte order
+      length = ntohl(skt->frame_header);
+
+      if (skt->frame_received == sizeof (length)) {
+         // increase buffer size if necessary
+         if ((error = frame_buffer(skt, length))) return (error);
+      }
+
+      if (skt->frame_received < sizeof (length) + length) continue;
+
+      skt->frame_received = 0;
+
+      // update counter
+      skt->xfer_rcvd += length;
+
+      skt->error_code = SNL_ERROR_OK;
+      skt->event_code = SNL_EVENT_RECEIVE;
+      skt->data_length = length;
+
+      skt->event_callback(skt);
+   }
+
+   return (SNL_ERROR_OK);
+}
+
+static void
+pool_bury(snl_pool_t *p) {
+   snl_socket_t *skt, *next;
+
+   pthread_mutex_lock(&p->lock);
+   skt = p->graveyard;
+   p->graveyard = NULL;
+   pthread_mutex_unlock(&p->lock);
+
+   // no event of this round refers to them anymore
+   for (; skt; skt = next) {
+      next = skt->pool_next;
+
+      snl_disconnect(skt);
+      worker_free(skt);
+   }
+}
+
+static void *
+pool_thread(void *arg) {
+   struct epoll_event ev[POOL_EVENTS];
+   snl_pool_t *p = (snl_pool_t *)arg;
+   snl_socket_t *skt;
+   uint64_t count;
+   int n, error;
+
+   while (!p->stop) {
+      if ((n = epoll_wait(p->epoll_fd, ev, POOL_EVENTS, -1)) < 0) {
+         if (errno == EINTR) continue;
+         break;
+      }
+
+      for (int i=0; i<n; i++) {
+         if (!(skt = ev[i].data.ptr)) {
+            while ((read(p->event_fd, &count, sizeof (count)) < 0) && (errno == EINTR));
+            continue;
+         }
+
+         // deleted by an earlier event of this round
+         if (skt->worker_stop) continue;
+
+         if (skt->worker_type == WORKER_THREAD_LISTEN) {
+            worker_accept(skt, skt->file_descriptor);
+         } else if ((error = pool_read(skt))) {
+            pool_unregister(skt, error);
+         }
+      }
+
+      pool_bury(p);
+   }
+
+   pool_bury(p);
+
+   return (NULL);
+}
+
 static void
-msleep(int ms) {
-   struct timespec tm;
+pool_delete(snl_socket_t *skt) {
+   snl_pool_t *p = skt->pool;
+
+   pthread_mutex_lock(&p->lock);
+
+   skt->worker_stop = 1;
+   epoll_ctl(p->epoll_fd, EPOLL_CTL_DEL, skt->file_descriptor, NULL);
 
-   tm.tv_sec = ms / 1000;
-   tm.tv_nsec = (ms % 1000) * 1000000;
+   skt->pool_next = p->graveyard;
+   p->graveyard = skt;
 
-   nanosleep(&tm, NULL);
+   pthread_mutex_unlock(&p->lock);
+
+   pool_wakeup(p);
 }
 
 snl_socket_t *
@@ -83,18 +362,44 @@ snl_socket_new(int proto, SNL_EVENT_CB(*cb), void *data) {
    skt->user_data       = data;
    skt->event_callback  = cb;
 
-   if (pthread_create(&skt->worker_tid, &thread_attr, &worker_thread, skt)) {
+   if ((skt->worker_event = eventfd(0, EFD_CLOEXEC)) < 0) {
       free(skt);
       return (NULL);
    }
 
+   pthread_mutex_init(&skt->worker_lock, NULL);
+   pthread_cond_init(&skt->worker_cond, NULL);
+
+   pthread_mutex_lock(&pool_lock);
+
+   // stream sockets share the threads of the pool, round robin
+   if (pool_size && (proto != SNL_PROTO_UDP)) {
+      skt->pool = &pool[pool_next++ % pool_size];
+   }
+
+   pthread_mutex_unlock(&pool_lock);
+
+   if (skt->pool) return (skt);
+
+   if (pthread_create(&skt->worker_tid, &thread_attr, &worker_thread, skt)) {
+      worker_free(skt);
+      return (NULL);
+   }
+
    return (skt);
 }
 
 int
 snl_socket_delete(snl_socket_t *skt) {
+   if (skt->pool) {
+      // closed and freed by the pool thread, which may be using it right now
+      pool_delete(skt);
+
+      return (SNL_ERROR_OK);
+   }
+
    // signal worker to stop
-   skt->worker_stop = 1;
+   worker_wakeup(skt);
 
    snl_disconnect(skt);
 
@@ -107,23 +412,18 @@ snl_socket_delete(snl_socket_t *skt) {
       // calling socket destructor from within worker,
       // detaching thread and committing suicide
 
-      free(skt->data_buffer);
-      free(skt);
-
       pthread_detach(skt->worker_tid);
-      pthread_exit(NULL); // WILL NOT RETURN
-   } else {
-      // destructor was not called from thread callback,
-      // wait for worker to terminate by itself
 
-      while (!skt->worker_stoped) {
-         msleep(5);
-      }
+      worker_free(skt);
 
-      free(skt->data_buffer);
-      free(skt);
+      pthread_exit(NULL); // WILL NOT RETURN
    }
 
+   // destructor was not called from thread callback,
+   // the worker has terminated once pthread_join() returns
+
+   worker_free(skt);
+
    return (SNL_ERROR_OK);
 }
 
@@ -154,9 +454,7 @@ snl_accept(snl_socket_t *skt) {
       setsockopt(fd, IPPROTO_TCP, TCP_LINGER2,   &lng, sizeof (lng));
    }
 
-   skt->worker_type = WORKER_THREAD_READ;
-
-   return (SNL_ERROR_OK);
+   return (worker_set_type(skt, WORKER_THREAD_READ));
 }
 
 int
@@ -215,6 +513,54 @@ cleanup:
    return (error);
 }
 
+int
+snl_post(snl_socket_t *skt, const void *buf, unsigned int len) {
+   struct msghdr msg;
+   struct iovec iov[2];
+   unsigned int length;
+   int sent;
+
+   if (skt->protocol == SNL_PROTO_UDP) return (snl_send(skt, buf, len));
+
+   // convert packet length to network byte order
+   length = htonl(len);
+
+   iov[0].iov_base = &length;
+   iov[0].iov_len = (skt->protocol == SNL_PROTO_TCP) ? 0 : sizeof (length);
+   iov[1].iov_base = (void *)buf;
+   iov[1].iov_len = len;
+
+   memset(&msg, 0, sizeof (msg));
+   msg.msg_iov = iov;
+   msg.msg_iovlen = 2;
+
+   // header and payload go out together or the rest waits in the kernel
+   while (iov[0].iov_len || iov[1].iov_len) {
+      if ((sent = sendmsg(skt->file_descriptor, &msg, MSG_DONTWAIT | MSG_NOSIGNAL)) == -1) {
+         if (errno == EINTR) continue;
+
+         // a peer that does not read must not hold up the sender,
+         // half a frame in the stream leaves nothing to recover either
+         shutdown(skt->file_descriptor, SHUT_RDWR);
+
+         return (SNL_ERROR_CLOSED);
+      }
+
+      for (int i=0; i<2; i++) {
+         unsigned int step = ((unsigned int)sent < iov[i].iov_len) ? (unsigned int)sent : iov[i].iov_len;
+
+         iov[i].iov_base = (char *)iov[i].iov_base + step;
+         iov[i].iov_len -= step;
+         sent -= step;
+      }
+   }
+
+   // update stats
+   skt->xfer_sent += len;
+
+   return (SNL_ERROR_OK);
+}
+
 int
 snl_write(int fd, const void *buf, unsigned int len) {
    unsigned int remaining = len;
@@ -234,6 +580,28 @@ snl_write(int fd, const void *buf, unsigned int len) {
    return (SNL_ERROR_OK);
 }
 
+int
+snl_sendto(int fd, const void *buf, unsigned int len, unsigned int ip, unsigned short port) {
+   struct sockaddr_in addr;
+
+   // check for packet size overflow
+   if (len > UDP_PAYLOAD_SIZE) {
+      return (SNL_ERROR_SEND);
+   }
+
+   memset(&addr, 0, sizeof (addr));
+   addr.sin_family = AF_INET;
+   addr.sin_port = port;
+   addr.sin_addr.s_addr = htonl(ip);
+
+   while (sendto(fd, buf, len, 0, (SA *)&addr, sizeof (addr)) != (int)len) {
+      if (errno == EINTR) continue;
+      return (SNL_ERROR_SEND);
+   }
+
+   return (SNL_ERROR_OK);
+}
+
 int
 snl_listen(snl_socket_t *skt, unsigned short port) {
    int type = (skt->protocol == SNL_PROTO_UDP) ? SOCK_DGRAM : SOCK_STREAM;
@@ -298,14 +666,36 @@ cleanup:
    switch (skt->protocol) {
       case SNL_PROTO_TCP:
       case SNL_PROTO_MSG:
-         skt->worker_type = WORKER_THREAD_LISTEN;
+         error = worker_set_type(skt, WORKER_THREAD_LISTEN);
       break;
 
       case SNL_PROTO_UDP:
-         skt->worker_type = WORKER_THREAD_RECEIVE;
+         error = worker_set_type(skt, WORKER_THREAD_RECEIVE);
       break;
    }
 
+   return (error);
+}
+
+int
+snl_batch(snl_socket_t *skt, unsigned int slots, unsigned int size) {
+   if (skt->protocol != SNL_PROTO_UDP) {
+      return (SNL_ERROR_PROTOCOL);
+   }
+
+   // socket already in use
+   if (skt->worker_type != WORKER_THREAD_UNKNOWN) {
+      return (SNL_ERROR_BUSY);
+   }
+
+   // sanity check
+   if (!slots || (slots > UDP_BATCH_MAX) || !size || (size > UDP_PAYLOAD_SIZE)) {
+      return (SNL_ERROR_BUFFER);
+   }
+
+   skt->batch_slots = slots;
+   skt->batch_size = size;
+
    return (SNL_ERROR_OK);
 }
 
@@ -328,6 +718,7 @@ snl_error_string(int error) {
       case SNL_ERROR_THREAD:     return ("could not start worker thread");
       case SNL_ERROR_TIMEOUT:    return ("timeout error");
       case SNL_ERROR_BUSY:       return ("socket already in use");
+      case SNL_ERROR_FRAME:      return ("datagram too long");
    }
 
    return ("unknown error");
@@ -434,23 +825,25 @@ snl_connect(snl_socket_t *skt, const char *host, unsigned short port) {
       setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &to, sizeof (to));
    }
 
+cleanup:
+
+   if (error && (fd >= 0)) close(fd);
+
+   skt->file_descriptor = fd;
+
+   if (error) return (error);
+
    // trigger worker thread
    switch (skt->protocol) {
       case SNL_PROTO_TCP:
       case SNL_PROTO_MSG:
-         skt->worker_type = WORKER_THREAD_READ;
+         error = worker_set_type(skt, WORKER_THREAD_READ);
       break;
       case SNL_PROTO_UDP:
-         skt->worker_type = WORKER_THREAD_IDLE;
+         error = worker_set_type(skt, WORKER_THREAD_IDLE);
       break;
    }
 
-cleanup:
-
-   if (error && (fd >= 0)) close(fd);
-
-   skt->file_descriptor = fd;
-
    return (error);
 }
 
@@ -463,6 +856,95 @@ snl_disconnect(snl_socket_t *skt) {
    return (SNL_ERROR_OK);
 }
 
+int
+snl_backlog(int backlog) {
+   if (backlog < 1) return (SNL_ERROR_LISTEN);
+
+   connection_backlog = backlog;
+
+   return (SNL_ERROR_OK);
+}
+
+int
+snl_frame_max(unsigned int max) {
+   frame_max = max;
+
+   return (SNL_ERROR_OK);
+}
+
+static void
+pool_stop(void) {
+   for (int i=0; i<pool_size; i++) {
+      pool[i].stop = 1;
+      pool_wakeup(&pool[i]);
+      pthread_join(pool[i].tid, NULL);
+
+      close(pool[i].epoll_fd);
+      close(pool[i].event_fd);
+      pthread_mutex_destroy(&pool[i].lock);
+   }
+
+   free(pool);
+
+   pool = NULL;
+   pool_size = 0;
+}
+
+int
+snl_pool(unsigned int threads) {
+   struct epoll_event ev;
+   snl_pool_t *p;
+   int error = SNL_ERROR_OK;
+
+   pthread_mutex_lock(&pool_lock);
+
+   if (pool_size) pool_stop();
+
+   if (!threads) goto cleanup;
+
+   if (!(pool = calloc(threads, sizeof (snl_pool_t)))) {
+      error = SNL_ERROR_BUFFER;
+      goto cleanup;
+   }
+
+   for (pool_size=0; pool_size<threads; pool_size++) {
+      p = &pool[pool_size];
+
+      p->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+      p->event_fd = eventfd(0, EFD_CLOEXEC);
+
+      // a NULL pointer marks the wakeup event
+      memset(&ev, 0, sizeof (ev));
+      ev.events = EPOLLIN;
+
+      if ((p->epoll_fd < 0) || (p->event_fd < 0) ||
+          epoll_ctl(p->epoll_fd, EPOLL_CTL_ADD, p->event_fd, &ev)) {
+         error = SNL_ERROR_THREAD;
+      } else {
+         pthread_mutex_init(&p->lock, NULL);
+
+         if (pthread_create(&p->tid, &thread_attr, &pool_thread, p)) {
+            pthread_mutex_destroy(&p->lock);
+            error = SNL_ERROR_THREAD;
+         }
+      }
+
+      if (error) {
+         if (p->epoll_fd >= 0) close(p->epoll_fd);
+         if (p->event_fd >= 0) close(p->event_fd);
+         break;
+      }
+   }
+
+   if (error) pool_stop();
+
+cleanup:
+
+   pthread_mutex_unlock(&pool_lock);
+
+   return (error);
+}
+
 int
 snl_init(void) {
    // catch SIGPIPE to avoid aborting on broken pipes.
@@ -475,40 +957,197 @@ snl_init(void) {
    return (0);
 }
 
+static int
+worker_poll_open(snl_socket_t *skt, int fd) {
+   struct epoll_event ev;
+   int epfd;
+
+   if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+      return (-1);
+   }
+
+   memset(&ev, 0, sizeof (ev));
+   ev.events = EPOLLIN;
+
+   ev.data.fd = fd;
+   if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) goto error;
+
+   ev.data.fd = skt->worker_event;
+   if (epoll_ctl(epfd, EPOLL_CTL_ADD, skt->worker_event, &ev)) goto error;
+
+   return (epfd);
+
+error:
+
+   close(epfd);
+
+   return (-1);
+}
+
+static int
+worker_poll_wait(snl_socket_t *skt, int epfd) {
+   struct epoll_event ev;
+   uint64_t count;
+
+   // block until the socket gets readable or the worker is told to stop
+   if (epoll_wait(epfd, &ev, 1, -1) <= 0) return (0);
+
+   if (ev.data.fd != skt->worker_event) return (1);
+
+   // consume the wakeup, the caller checks worker_stop
+   while ((read(skt->worker_event, &count, sizeof (count)) < 0) && (errno == EINTR));
+
+   return (0);
+}
+
+static int
+worker_receive_batch(snl_socket_t *skt, int fd, int epfd) {
+   unsigned int slots = skt->batch_slots, size = skt->batch_size;
+   struct sockaddr_in addr[slots];
+   struct mmsghdr msg[slots];
+   struct iovec iov[slots];
+   snl_datagram_t *dgram;
+   char *ptr = skt->data_buffer;
+   int received;
+
+   memset(msg, 0, sizeof (msg));
+
+   // every slot owns a fixed part of the buffer, plus one byte for the zero
+   for (int i=0; i<slots; i++) {
+      iov[i].iov_base = ptr + i * (size + 1);
+      iov[i].iov_len = size;
+
+      msg[i].msg_hdr.msg_iov = &iov[i];
+      msg[i].msg_hdr.msg_iovlen = 1;
+      msg[i].msg_hdr.msg_name = &addr[i];
+   }
+
+   // wait for messages
+   while (!skt->worker_stop) {
+      if (!worker_poll_wait(skt, epfd)) continue;
+
+      if (skt->worker_stop) {
+         break;
+      }
+
+      for (int i=0; i<slots; i++) {
+         msg[i].msg_hdr.msg_namelen = sizeof (addr[i]);
+      }
+
+      // drain as much as fits into the slots with a single syscall
+      if ((received = recvmmsg(fd, msg, slots, MSG_DONTWAIT, NULL)) < 0) {
+         if ((errno == EAGAIN) || (errno == EINTR)) continue;
+
+         skt->error_code = SNL_ERROR_RECEIVE;
+         skt->event_code = SNL_EVENT_ERROR;
+         skt->event_callback(skt);
+         continue;
+      }
+
+      skt->batch_length = 0;
+
+      for (int i=0; i<received; i++) {
+         // does not fit into a slot
+         if (msg[i].msg_hdr.msg_flags & MSG_TRUNC) continue;
+
+         dgram = &skt->batch[skt->batch_length++];
+
+         dgram->data = iov[i].iov_base;
+         dgram->length = msg[i].msg_len;
+         dgram->client_port = addr[i].sin_port;
+         dgram->client_ip = ntohl(addr[i].sin_addr.s_addr);
+
+         ((char *)dgram->data)[dgram->length] = '\0';
+
+         // update counter
+         skt->xfer_rcvd += dgram->length;
+      }
+
+      if (!skt->batch_length) continue;
+
+      skt->client_fd = fd;
+
+      skt->error_code = SNL_ERROR_OK;
+      skt->event_code = SNL_EVENT_BATCH;
+
+      skt->event_callback(skt);
+   }
+
+   return (SNL_ERROR_OK);
+}
+
+static void
+worker_accept(snl_socket_t *skt, int fd) {
+   struct sockaddr_in addr;
+   socklen_t len;
+   int new_fd;
+
+   // take every connection that is pending, bursts would overflow the backlog
+   while (!skt->worker_stop) {
+      memset(&addr, 0, sizeof (addr));
+      len = sizeof (addr);
+
+      if ((new_fd = accept(fd, (SA *)&addr, &len)) < 0) {
+         if (errno == EINTR) continue;
+         if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;
+
+         skt->error_code = SNL_ERROR_ACCEPT;
+         skt->event_code = SNL_EVENT_ERROR;
+         skt->event_callback(skt);
+         break;
+      }
+
+      skt->error_code = SNL_ERROR_OK;
+      skt->event_code = SNL_EVENT_ACCEPT;
+
+      skt->client_port = addr.sin_port;
+      skt->client_ip = ntohl(addr.sin_addr.s_addr);
+      skt->client_fd = new_fd;
+
+      skt->event_callback(skt);
+   }
+}
+
 static void *
 worker_thread(void *arg) {
-   int remaining, received, new_fd, max_fd, fd, error;
+   int remaining, received, fd, error, epfd;
    snl_socket_t *skt = (snl_socket_t *)arg;
    struct sockaddr_in addr;
    unsigned int length;
    struct sockaddr *sa;
-   struct timeval tv;
    socklen_t len;
-   fd_set fds;
    char *ptr;
 
 worker_start:
 
    error = SNL_ERROR_OK;
-   max_fd = -1;
+   epfd = -1;
+
+   pthread_mutex_lock(&skt->worker_lock);
 
    // wait for worker thread to get the right type
-   while (skt->worker_type == WORKER_THREAD_UNKNOWN) {
-      if (skt->worker_stop) {
-         skt->worker_stoped = 1;
-         return (NULL);
+   while ((skt->worker_type == WORKER_THREAD_UNKNOWN) && !skt->worker_stop) {
+      pthread_cond_wait(&skt->worker_cond, &skt->worker_lock);
+   }
+
+   if (skt->worker_type == WORKER_THREAD_UNKNOWN) {
+      skt->worker_stoped = 1;
+      pthread_mutex_unlock(&skt->worker_lock);
+      return (NULL);
+   }
+
+   if (skt->worker_type == WORKER_THREAD_IDLE) {
+      // nothing to receive, sleep until the socket gets deleted
+      while (!skt->worker_stop) {
+         pthread_cond_wait(&skt->worker_cond, &skt->worker_lock);
       }
-      msleep(5);
    }
 
+   pthread_mutex_unlock(&skt->worker_lock);
+
    switch (skt->worker_type) {
 
       default:
-         // TODO use condition signal instead
-         while (!skt->worker_stop) {
-            msleep(5);
-         }
-
          goto worker_stop;
       break;
 
@@ -567,12 +1206,8 @@ worker_start:
                length = ntohl(length);
 
                // increase buffer size if necessary
-               if (length > skt->buffer_length) {
-                  skt->buffer_length = length * 2;
-                  if (!(skt->data_buffer = realloc(skt->data_buffer, skt->buffer_length))) {
-                     error = SNL_ERROR_BUFFER;
-                     goto worker_stop;
-                  }
+               if ((error = frame_buffer(skt, length))) {
+                  goto worker_stop;
                }
 
                // read datagram
@@ -616,44 +1251,20 @@ worker_start:
 
          fd = skt->file_descriptor;
 
+         if ((epfd = worker_poll_open(skt, fd)) < 0) {
+            error = SNL_ERROR_LISTEN;
+            goto worker_stop;
+         }
+
          // wait for connections
          while (!skt->worker_stop) {
-            tv.tv_sec = 0;
-            tv.tv_usec = 5000; // 5 ms
-
-            FD_ZERO(&fds);
-            if (fd >= 0) {
-               FD_SET(fd, &fds);
-               if (fd > max_fd) max_fd = fd;
-            }
-
-            // test if blocking in accept would time out
-            if ((select(max_fd + 1, &fds, NULL, NULL, &tv)) <= 0) continue;
+            if (!worker_poll_wait(skt, epfd)) continue;
 
             if (skt->worker_stop) {
                goto worker_stop;
             }
 
-            sa = (SA *)&addr; len = sizeof (addr);
-            if (fd >= 0 && FD_ISSET(fd, &fds)) {
-               new_fd = accept(fd, sa, &len);
-
-               if (new_fd < 0) {
-                  if ((errno == EAGAIN) || (errno == EINTR)) continue;
-
-                  skt->error_code = SNL_ERROR_ACCEPT;
-                  skt->event_code = SNL_EVENT_ERROR;
-               } else {
-                  skt->error_code = SNL_ERROR_OK;
-                  skt->event_code = SNL_EVENT_ACCEPT;
-
-                  skt->client_port = addr.sin_port;
-                  skt->client_ip = ntohl(addr.sin_addr.s_addr);
-                  skt->client_fd = new_fd;
-               }
-
-               skt->event_callback(skt);
-            }
+            worker_accept(skt, fd);
          }
       break;
 
@@ -662,8 +1273,12 @@ worker_start:
 
          fd = skt->file_descriptor;
 
-         // set buffer size to maximum size of udp datagrams
-         skt->buffer_length = UDP_PAYLOAD_SIZE;
+         // set buffer size to maximum size of udp datagrams, or the slots
+         if (skt->batch_slots) {
+            skt->buffer_length = skt->batch_slots * (skt->batch_size + 1);
+         } else {
+            skt->buffer_length = UDP_PAYLOAD_SIZE;
+         }
 
          // allocate buffer for received data
          if (!(skt->data_buffer = realloc(skt->data_buffer, skt->buffer_length))) {
@@ -671,51 +1286,57 @@ worker_start:
             goto worker_stop;
          }
 
-         // wait for messages
-         while (!skt->worker_stop) {
-            tv.tv_sec = 0;
-            tv.tv_usec = 5000; // 5 ms
-
-            FD_ZERO(&fds);
-            if (fd >= 0) {
-               FD_SET(fd, &fds);
-               if (fd > max_fd) max_fd = fd;
+         if (skt->batch_slots) {
+            if (!(skt->batch = realloc(skt->batch, skt->batch_slots * sizeof (snl_datagram_t)))) {
+               error = SNL_ERROR_BUFFER;
+               goto worker_stop;
             }
+         }
+
+         if ((epfd = worker_poll_open(skt, fd)) < 0) {
+            error = SNL_ERROR_RECEIVE;
+            goto worker_stop;
+         }
+
+         if (skt->batch_slots) {
+            error = worker_receive_batch(skt, fd, epfd);
+            goto worker_stop;
+         }
 
-            // test if blocking in recvfrom would time out
-            if ((select(max_fd + 1, &fds, NULL, NULL, &tv)) <= 0) continue;
+         // wait for messages
+         while (!skt->worker_stop) {
+            if (!worker_poll_wait(skt, epfd)) continue;
 
             if (skt->worker_stop) {
                goto worker_stop;
             }
 
             sa = (SA *)&addr; len = sizeof (addr);
-            if (fd >= 0 && FD_ISSET(fd, &fds)) {
-               received = recvfrom(fd, skt->data_buffer, skt->buffer_length, 0, sa, &len);
 
-               if (received < 0) {
-                  if ((errno == EAGAIN) || (errno == EINTR)) continue;
+            received = recvfrom(fd, skt->data_buffer, skt->buffer_length, 0, sa, &len);
 
-                  skt->error_code = SNL_ERROR_RECEIVE;
-                  skt->event_code = SNL_EVENT_ERROR;
-               } else {
-                  length = received;
+            if (received < 0) {
+               if ((errno == EAGAIN) || (errno == EINTR)) continue;
 
-                  skt->client_port = addr.sin_port;
-                  skt->client_ip = ntohl(addr.sin_addr.s_addr);
-                  skt->client_fd = fd;
+               skt->error_code = SNL_ERROR_RECEIVE;
+               skt->event_code = SNL_EVENT_ERROR;
+            } else {
+               length = received;
 
-                  // update counter
-                  skt->xfer_rcvd += length;
+               skt->client_port = addr.sin_port;
+               skt->client_ip = ntohl(addr.sin_addr.s_addr);
+               skt->client_fd = fd;
 
-                  skt->error_code = SNL_ERROR_OK;
-                  skt->event_code = SNL_EVENT_RECEIVE;
+               // update counter
+               skt->xfer_rcvd += length;
 
-                  skt->data_length = length;
-               }
- 
-               skt->event_callback(skt);
+               skt->error_code = SNL_ERROR_OK;
+               skt->event_code = SNL_EVENT_RECEIVE;
+
+               skt->data_length = length;
             }
+
+            skt->event_callback(skt);
          }
       break;
 
@@ -723,6 +1344,8 @@ worker_start:
 
 worker_stop:
 
+   if (epfd >= 0) close(epfd);
+
    skt->worker_type = WORKER_THREAD_UNKNOWN;
 
    if (error && !skt->worker_stop) {
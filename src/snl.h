@@ -41,6 +41,19 @@
 extern "C" {
 #endif
 
+/**
+   \brief   One datagram of a batch
+
+   In batched receive mode a single SNL_EVENT_BATCH event hands over
+   all datagrams that were pending in the socket buffer.
+*/
+typedef struct snl_datagram_t {
+   void *data;
+   unsigned int length;
+   unsigned short client_port;
+   unsigned int client_ip;
+} snl_datagram_t;
+
 /**
    \brief   Struct for all Connection related information
 
@@ -64,6 +77,17 @@ typedef struct snl_socket_t {
    int worker_stoped;
    int worker_stop;
    pthread_t worker_tid;
+   pthread_mutex_t worker_lock;
+   pthread_cond_t worker_cond;
+   int worker_event;
+   snl_datagram_t *batch;
+   unsigned int batch_slots;
+   unsigned int batch_size;
+   unsigned int batch_length;
+   void *pool;
+   struct snl_socket_t *pool_next;
+   unsigned int frame_header;
+   unsigned int frame_received;
    void *user_data;
    void (*event_callback)();
 } snl_socket_t;
@@ -89,7 +113,8 @@ enum {
    SNL_EVENT_ERROR,
    SNL_EVENT_ACCEPT,
    SNL_EVENT_RECEIVE,
-   SNL_EVENT_READ
+   SNL_EVENT_READ,
+   SNL_EVENT_BATCH
 };
 
 /**
@@ -112,6 +137,7 @@ enum {
    SNL_ERROR_THREAD,       ///< 13: could not start worker thread
    SNL_ERROR_TIMEOUT,      ///< 14: timeout error
    SNL_ERROR_BUSY,         ///< 15: socket is already connected or listening
+   SNL_ERROR_FRAME,        ///< 16: announced datagram exceeds the frame limit
 };
 
 /**
@@ -161,6 +187,20 @@ int snl_socket_delete(snl_socket_t *skt);
 */
 int snl_send(snl_socket_t *skt, const void *buf, unsigned int len);
 
+/**
+   \brief   Send data over a socket without waiting for the peer
+   \param   skt <snl_socket_t *> pointer to socket
+   \param   buf <const void *> pointer to send buffer
+   \param   len <unsigned int> length of data in buffer
+   \return  0 on success or a negative error code
+
+   Like snl_send(), but fails instead of blocking when the send buffer of
+   the connection is full. A frame that does not fit completely would
+   corrupt the stream, so the connection is shut down in that case and
+   the receiving side reports it as closed.
+*/
+int snl_post(snl_socket_t *skt, const void *buf, unsigned int len);
+
 /**
    \brief   Start a seperate thread to handle exact one socket connection
    \param   skt <snl_socket_t *> pointer to socket
@@ -186,6 +226,20 @@ int snl_accept(snl_socket_t *skt);
 */
 int snl_write(int fd, const void *buf, unsigned int len);
 
+/**
+   \brief   Send a datagram to a given peer
+   \param   fd <int> datagram socket filedescriptor
+   \param   buf <const void *> pointer to buffer start
+   \param   len <unsigned int> length of data to send
+   \param   ip <unsigned int> address in host byte order, like client_ip
+   \param   port <unsigned short> port in network byte order, like client_port
+   \return 0 on success or negative error code
+
+   Answers the sender of a datagram received on a listening UDP socket,
+   which is not connected to any peer, so snl_send() can not be used.
+*/
+int snl_sendto(int fd, const void *buf, unsigned int len, unsigned int ip, unsigned short port);
+
 /**
    \brief   Start a thread to listen for incoming connections
    \param   skt <snl_socket_t *> pointer to socket
@@ -199,6 +253,21 @@ int snl_write(int fd, const void *buf, unsigned int len);
 */
 int snl_listen(snl_socket_t *skt, unsigned short port);
 
+/**
+   \brief   Receive datagrams in batches
+   \param   skt <snl_socket_t *> pointer to socket
+   \param   slots <unsigned int> max number of datagrams per batch
+   \param   size <unsigned int> max length of a single datagram
+   \return  0 on success or a negative error code
+
+   Has to be called on a SNL_PROTO_UDP socket before snl_listen(). The
+   worker then reads up to \a slots datagrams with one recvmmsg() call
+   into preallocated slots and reports them with a single SNL_EVENT_BATCH
+   event in skt->batch and skt->batch_length. Every datagram is followed
+   by a terminating zero. Datagrams longer than \a size are dropped.
+*/
+int snl_batch(snl_socket_t *skt, unsigned int slots, unsigned int size);
+
 /**
    \brief   Connect to a listening socket
    \param   skt <snl_socket_t *> pointer to socket
@@ -230,6 +299,45 @@ int snl_disconnect(snl_socket_t *skt);
 */
 const char *snl_error_string(int error);
 
+/**
+   \brief   Set the listen backlog
+   \param   backlog <int> max number of pending connections
+   \return  0 on success or a negative error code
+
+   Applies to stream sockets that start listening afterwards. Clients
+   that connect in bursts are refused once the backlog is full.
+*/
+int snl_backlog(int backlog);
+
+/**
+   \brief   Limit the size of received SNL_PROTO_MSG datagrams
+   \param   max <unsigned int> longest datagram accepted in bytes, 0 for no limit
+   \return  0 on success or a negative error code
+
+   The length header of a framed datagram comes from the peer. A longer
+   announcement is rejected before any memory is allocated for it, the
+   connection then fails with SNL_ERROR_FRAME.
+*/
+int snl_frame_max(unsigned int max);
+
+/**
+   \brief   Multiplex stream sockets over a fixed pool of threads
+   \param   threads <unsigned int> number of I/O threads, 0 stops the pool
+   \return  0 on success or a negative error code
+
+   Without a pool every socket gets its own worker thread. Stream sockets
+   (SNL_PROTO_MSG and SNL_PROTO_TCP) created while the pool is running
+   share its threads instead, so many control connections cost neither a
+   thread nor a stack each. UDP sockets keep their own worker.
+
+   The callback of a pooled socket may still be running when
+   snl_socket_delete() returns in another thread, the socket is closed
+   and freed by its pool thread afterwards. Deleting a pooled socket from
+   within its own callback simply returns. All pooled sockets have to be
+   deleted before the pool is stopped.
+*/
+int snl_pool(unsigned int threads);
+
 /**
    \brief   Initialize the SNL library
    \return  0 on success or a negative error code
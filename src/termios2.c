@@ -0,0 +1,25 @@
+#include <asm/termbits.h>
+#include <sys/ioctl.h>
+
+#include "termios2.h"
+
+int
+Termios2SetSpeed(int fd, int baud) {
+   struct termios2 tio;
+
+   if (ioctl(fd, TCGETS2, &tio)) {
+      return (-1);
+   }
+
+   // let the driver derive the divisor from the plain number
+   tio.c_cflag &= ~CBAUD;
+   tio.c_cflag |= BOTHER;
+   tio.c_ispeed = baud;
+   tio.c_ospeed = baud;
+
+   if (ioctl(fd, TCSETS2, &tio)) {
+      return (-1);
+   }
+
+   return (0);
+}
@@ -0,0 +1,9 @@
+#ifndef _Z4CTRL_TERMIOS2_H_
+#define _Z4CTRL_TERMIOS2_H_
+
+// the kernel termios2 interface lives in its own translation unit,
+// because <asm/termbits.h> clashes with the <termios.h> of the libc
+
+int Termios2SetSpeed(int fd, int baud);
+
+#endif // _Z4CTRL_TERMIOS2_H_
@@ -0,0 +1,91 @@
+#include <string.h>
+#include <stdio.h>
+
+#include "serial.h"
+#include "registry.h"
+#include "transaction.h"
+
+static int
+Delimiter(const Device *dev) {
+   return ((dev->protocol == DEVICE_SANYO) ? '\r' : '\n');
+}
+
+static void
+Drop(Device *dev) {
+   dev->stats.stale++;
+
+   // a late answer to a command that timed out has shown up
+   if (dev->owed) dev->owed--;
+}
+
+void
+TransactionBegin(Device *dev) {
+   char frame[SERIAL_RX_SIZE];
+
+   if (!dev->serial) return;
+
+   // nothing is sent unsolicited, so whatever arrived by now answers an
+   // earlier command, the port itself is left alone, unlike with tcflush
+   for (int i=0; i<TRANSACTION_DRAIN_MAX; i++) {
+      if (SerialReceiveFrame(dev->serial, frame, sizeof (frame), Delimiter(dev), 0) < 0) break;
+
+      Drop(dev);
+   }
+}
+
+int
+TransactionReceive(Device *dev, char frame[], unsigned int cap, const char *cmd,
+                   int timeout, int (*plausible)(const char *cmd, const char *frame, int len)) {
+   long deadline = SerialTimestamp() + timeout;
+   char late[SERIAL_RX_SIZE];
+   int len, remaining, late_len = -1;
+
+   for (;;) {
+      remaining = deadline - SerialTimestamp();
+
+      len = SerialReceiveFrame(dev->serial, frame, cap, Delimiter(dev), (remaining > 0) ? remaining : 0);
+
+      if ((len == SERIAL_ERR_TIMEOUT) && (late_len >= 0)) {
+         // the owed answer got lost after all, so the last frame skipped was ours
+         memcpy(frame, late, late_len);
+         len = late_len;
+
+         dev->stats.stale--;
+         dev->owed = 0;
+
+         break;
+      }
+
+      if (len == SERIAL_ERR_TIMEOUT) {
+         // nothing usable for a whole timeout, older answers would have come
+         // first and are lost for good, only ours may still come and the
+         // next transaction has to skip it
+         dev->owed = 1;
+         return (len);
+      }
+
+      if (len < 0) return (len);
+
+      if (plausible && !plausible(cmd, frame, len)) {
+         // e.g. the ACK of a timed out command while waiting for a status
+         Drop(dev);
+         continue;
+      }
+
+      if (dev->owed) {
+         // answers come in order, an earlier command gets its answer first,
+         // even if it looks just like ours, e.g. an ACK or onkyo free text
+         memcpy(late, frame, len);
+         late_len = len;
+
+         Drop(dev);
+         continue;
+      }
+
+      break;
+   }
+
+   if (len < cap) frame[len] = '\0';
+
+   return (len);
+}
@@ -0,0 +1,12 @@
+#ifndef _Z4CTRL_TRANSACTION_H_
+#define _Z4CTRL_TRANSACTION_H_
+
+#include "device.h"
+
+#define TRANSACTION_DRAIN_MAX   16 // max number of stale frames dropped before a command
+
+void TransactionBegin(Device *dev);
+int TransactionReceive(Device *dev, char frame[], unsigned int cap, const char *cmd,
+                       int timeout, int (*plausible)(const char *cmd, const char *frame, int len));
+
+#endif // _Z4CTRL_TRANSACTION_H_
@@ -0,0 +1,373 @@
+#define _GNU_SOURCE // posix_openpt(), ptsname()
+
+#include <sys/stat.h>
+#include <pthread.h>
+#include <termios.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "../src/command.h"
+
+#define MAX_DEVICES     16
+#define BUFFER_SIZE    256
+
+enum {
+   TYPE_SANYO,
+   TYPE_ONKYO
+};
+
+typedef struct Device {
+   int type;
+   int master;
+   int slave;
+   char link[256];
+   pthread_t tid;
+
+   int baud;              // pacing of the emulated uart
+   int next_baud;         // rate to switch to after the current answer
+   unsigned int commands; // number of commands answered
+
+   // projector state
+   int power;             // status code as reported by CR0
+   int target;            // power state after the current transition
+   long transition;       // end of warm-up or cool-down in ms
+   int input;
+   int lamp_hours;
+} Device;
+
+static Device device[MAX_DEVICES];
+static int devices = 0;
+
+static int warmup   = 5000; // duration of the countdown in ms
+static int cooldown = 5000; // duration of the cooling down in ms
+static int latency  =   10; // processing time of the device in ms
+
+static volatile int shutdown_requested = 0;
+
+static const char *sanyo_commands[] = {
+   POWER_ON, POWER_OFF_QUICK, POWER_OFF_ASK, MUTE_ON, MUTE_OFF,
+   SCALE_NORMAL, SCALE_FULL, SCALE_ZOOM, SCALE_WIDE_1, SCALE_WIDE_2,
+   SCALE_CAPTION, SCALE_FULL_THROUGH, SCALE_NORMAL_THROUGH,
+   LAMP_AUTO_1, LAMP_AUTO_2, LAMP_NORMAL, LAMP_ECONOMY,
+   MENU_ON, MENU_OFF, MENU_CLEAR,
+   INPUT_COMPOSIT, INPUT_SVIDEO, INPUT_COMPONENT_1, INPUT_COMPONENT_2,
+   INPUT_VGA, INPUT_HDMI,
+   PRESS_RIGHT, PRESS_LEFT, PRESS_UP, PRESS_DOWN, PRESS_ENTER,
+   COLOR_LIVING, COLOR_CREATIVE, COLOR_CINEMA, COLOR_USER_1, COLOR_USER_2,
+   COLOR_USER_3, COLOR_USER_4, COLOR_VIVID, COLOR_DYNAMIC, COLOR_POWERFUL,
+   COLOR_NATURAL,
+   LOGO_OFF, LOGO_DEFAULT, LOGO_USER, LOGO_CAPTURE,
+   POWER_MANAGEMENT_ON, POWER_MANAGEMENT_OFF, D4_CONTROL_ON, D4_CONTROL_OFF,
+   CEILING_ON, CEILING_OFF, REAR_ON, REAR_OFF, PC_ADJUST,
+   KEYSTONE_PLUS, KEYSTONE_MINUS,
+   NULL
+};
+
+static const char *onkyo_commands[] = {
+   "status", "power", "vol+", "vol-", "mute", "xbox", "ps2",
+   "speaker", "movie", "game", "music", "stereo",
+   NULL
+};
+
+static void
+PrintUsage(void) {
+   puts("");
+   puts("z4emu " VERSION " <clemens@1541.org>");
+   puts("");
+   puts("USAGE: z4emu [-s num] [-o num] [-w ms] [-c ms] [-l ms] [dir]");
+   puts("");
+   puts("\t-s num ... number of emulated Sanyo projectors (default 1)");
+   puts("\t-o num ... number of emulated Onkyo receivers (default 1)");
+   puts("\t-w ms  ... duration of the power on countdown (default 5000)");
+   puts("\t-c ms  ... duration of the cooling down (default 5000)");
+   puts("\t-l ms  ... processing time per command (default 10)");
+   puts("\tdir    ... where to create the port links (default /tmp/z4emu)");
+   puts("");
+   puts("Point z4ctrl to the emulated ports with Z4CTRL_SERIAL_DIR=<dir>.");
+   puts("");
+
+   exit(0);
+}
+
+static long
+Timestamp(void) {
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   return (now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+static void
+Delay(long us) {
+   struct timespec tm;
+
+   tm.tv_sec = us / 1000000;
+   tm.tv_nsec = (us % 1000000) * 1000;
+
+   nanosleep(&tm, NULL);
+}
+
+static void
+Transmit(Device *dev, const char *buf, int len) {
+   // 8N1 needs ten bit times per character
+   long char_us = 10000000L / dev->baud;
+
+   for (int i=0; i<len; i++) {
+      Delay(char_us);
+
+      while ((write(dev->master, &buf[i], 1) < 0) && (errno == EINTR));
+   }
+}
+
+static void
+UpdatePower(Device *dev) {
+   if ((dev->power != dev->target) && (Timestamp() >= dev->transition)) {
+      dev->power = dev->target;
+   }
+}
+
+static void
+StartTransition(Device *dev, int state, int target, int duration) {
+   dev->power = state;
+   dev->target = target;
+   dev->transition = Timestamp() + duration;
+}
+
+static int
+SanyoCommand(Device *dev, const char *cmd, char *ret) {
+   int known = 0;
+
+   UpdatePower(dev);
+
+   if (!strcmp(cmd, READ_POWER_STATUS)) return (sprintf(ret, "%02i\r", dev->power));
+   if (!strcmp(cmd, READ_INPUT_MODE))   return (sprintf(ret, "%i\r", dev->input));
+   if (!strcmp(cmd, READ_LAMP_HOURS))   return (sprintf(ret, "%05i\r", dev->lamp_hours));
+   if (!strcmp(cmd, READ_MODEL_NUMBER)) return (sprintf(ret, "PLV-Z4\r"));
+   if (!strcmp(cmd, READ_TEMP_SENSORS)) return (sprintf(ret, "31.5 36.0 42.5\r"));
+
+   for (int i=0; sanyo_commands[i]; i++) {
+      if (!strcmp(cmd, sanyo_commands[i])) known = 1;
+   }
+
+   if (!known) return (sprintf(ret, "?\r"));
+
+   // while warming up or cooling down the projector ignores commands
+   if (dev->power != dev->target) return (0);
+
+   if (!strcmp(cmd, POWER_ON)) {
+      if (dev->power == 80) StartTransition(dev, 40, 0, warmup);
+      return (sprintf(ret, "\006\r"));
+   }
+
+   if (!strcmp(cmd, POWER_OFF_QUICK) || !strcmp(cmd, POWER_OFF_ASK)) {
+      if (dev->power == 0) StartTransition(dev, 20, 80, cooldown);
+      return (sprintf(ret, "\006\r"));
+   }
+
+   // in stand-by only power on is accepted
+   if (dev->power != 0) return (sprintf(ret, "?\r"));
+
+   if (!strcmp(cmd, INPUT_COMPOSIT))    dev->input = 0;
+   if (!strcmp(cmd, INPUT_SVIDEO))      dev->input = 1;
+   if (!strcmp(cmd, INPUT_COMPONENT_1)) dev->input = 2;
+   if (!strcmp(cmd, INPUT_COMPONENT_2)) dev->input = 3;
+   if (!strcmp(cmd, INPUT_HDMI))        dev->input = 4;
+   if (!strcmp(cmd, INPUT_VGA))         dev->input = 5;
+
+   return (sprintf(ret, "\006\r"));
+}
+
+static int
+OnkyoCommand(Device *dev, const char *cmd, char *ret) {
+   // autobaud handshake, acknowledged at the old rate
+   if (!strncmp(cmd, "baud ", 5) && (atoi(cmd + 5) > 0)) {
+      dev->next_baud = atoi(cmd + 5);
+
+      return (sprintf(ret, "ok\r\n"));
+   }
+
+   for (int i=0; onkyo_commands[i]; i++) {
+      if (!strcmp(cmd, onkyo_commands[i])) {
+         // sending the IR frame takes about as long as the remote does
+         if (i) Delay(70000);
+
+         return (sprintf(ret, "ok\r\n"));
+      }
+   }
+
+   return (sprintf(ret, "?\r\n"));
+}
+
+static void *
+DeviceThread(void *arg) {
+   Device *dev = (Device *)arg;
+   char buffer[BUFFER_SIZE], ret[BUFFER_SIZE];
+   int length = 0, received, len;
+   char delimiter = (dev->type == TYPE_SANYO) ? '\r' : '\n';
+   char *end;
+
+   while (!shutdown_requested) {
+      received = read(dev->master, buffer + length, BUFFER_SIZE - length - 1);
+
+      if (received < 0) {
+         if (errno == EINTR) continue;
+         break;
+      }
+
+      length += received;
+      buffer[length] = '\0';
+
+      while ((end = memchr(buffer, delimiter, length))) {
+         char cmd[BUFFER_SIZE];
+         int cmdlen = end - buffer + 1;
+
+         memcpy(cmd, buffer, cmdlen);
+         cmd[(dev->type == TYPE_SANYO) ? cmdlen : cmdlen - 1] = '\0';
+
+         length -= cmdlen;
+         memmove(buffer, end + 1, length);
+
+         // the command itself took its time on the wire
+         Delay(cmdlen * 10000000L / dev->baud + latency * 1000L);
+
+         if (dev->type == TYPE_SANYO) {
+            len = SanyoCommand(dev, cmd, ret);
+         } else {
+            len = OnkyoCommand(dev, cmd, ret);
+         }
+
+         if (len > 0) Transmit(dev, ret, len);
+
+         if (dev->next_baud) {
+            dev->baud = dev->next_baud;
+            dev->next_baud = 0;
+         }
+
+         dev->commands++;
+      }
+
+      // drop garbage that never gets terminated
+      if (length == BUFFER_SIZE - 1) length = 0;
+   }
+
+   return (NULL);
+}
+
+static int
+CreateDevice(int type, const char *dir, int index) {
+   Device *dev = &device[devices];
+   struct termios tio;
+   const char *name;
+
+   memset(dev, 0, sizeof (Device));
+   dev->type = type;
+   dev->baud = 19200;
+   dev->power = dev->target = 80;
+   dev->input = 4;
+   dev->lamp_hours = 1234;
+
+   if ((dev->master = posix_openpt(O_RDWR | O_NOCTTY)) < 0) return (-1);
+
+   if (grantpt(dev->master) || unlockpt(dev->master) || !(name = ptsname(dev->master))) {
+      close(dev->master);
+      return (-1);
+   }
+
+   // keep the slave open, so the master survives clients closing the port
+   if ((dev->slave = open(name, O_RDWR | O_NOCTTY)) < 0) {
+      close(dev->master);
+      return (-1);
+   }
+
+   tcgetattr(dev->slave, &tio);
+   cfmakeraw(&tio);
+   tcsetattr(dev->slave, TCSANOW, &tio);
+
+   snprintf(dev->link, sizeof (dev->link), "%s/%s-%i", dir,
+            (type == TYPE_SANYO) ? "sanyo" : "onkyo", index);
+
+   unlink(dev->link);
+
+   if (symlink(name, dev->link)) {
+      close(dev->slave);
+      close(dev->master);
+      return (-1);
+   }
+
+   printf("%s %i on %s -> %s\n", (type == TYPE_SANYO) ? "Sanyo projector" :
+          "Onkyo receiver", index, dev->link, name);
+
+   devices++;
+
+   return (0);
+}
+
+int
+main(int argc, char **argv) {
+   const char *dir = "/tmp/z4emu";
+   int sanyos = 1, onkyos = 1, opt, sig;
+   sigset_t signals;
+
+   while ((opt = getopt(argc, argv, "s:o:w:c:l:h")) != -1) {
+      switch (opt) {
+         case 's': sanyos   = atoi(optarg); break;
+         case 'o': onkyos   = atoi(optarg); break;
+         case 'w': warmup   = atoi(optarg); break;
+         case 'c': cooldown = atoi(optarg); break;
+         case 'l': latency  = atoi(optarg); break;
+         default: PrintUsage();
+      }
+   }
+
+   if (optind < argc) dir = argv[optind];
+
+   if (sanyos + onkyos > MAX_DEVICES) {
+      printf("at most %i devices can be emulated.\n", MAX_DEVICES);
+      exit(-1);
+   }
+
+   mkdir(dir, 0755);
+
+   for (int i=0; i<sanyos; i++) {
+      if (CreateDevice(TYPE_SANYO, dir, i)) {
+         printf("could not create emulated projector %i.\n", i);
+      }
+   }
+
+   for (int i=0; i<onkyos; i++) {
+      if (CreateDevice(TYPE_ONKYO, dir, i)) {
+         printf("could not create emulated receiver %i.\n", i);
+      }
+   }
+
+   fflush(stdout);
+
+   sigemptyset(&signals);
+   sigaddset(&signals, SIGINT);
+   sigaddset(&signals, SIGTERM);
+
+   // the device threads inherit the mask, so only main ever sees the signals
+   pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+   for (int i=0; i<devices; i++) {
+      pthread_create(&device[i].tid, NULL, DeviceThread, &device[i]);
+   }
+
+   sigwait(&signals, &sig);
+
+   shutdown_requested = 1;
+
+   for (int i=0; i<devices; i++) {
+      printf("%s: %u commands\n", device[i].link, device[i].commands);
+      unlink(device[i].link);
+   }
+
+   return (0);
+}
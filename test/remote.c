@@ -6,6 +6,13 @@
 #include <unistd.h>
 #include <signal.h>
 #include <stdio.h>
+#include <poll.h>
+
+#define REMOTE_PORT           1541
+#define REMOTE_TIMEOUT        5000 // time to wait for a reply before sending again in ms,
+                                   // longer than the server waits for a projector
+#define REMOTE_RETRIES           3 // requests sent before giving up
+#define REMOTE_PARK_TIMEOUT 120000 // max time a queued request may take in ms
 
 static void
 PrintUsage(void) {
@@ -17,12 +24,15 @@ PrintUsage(void) {
    puts("\tcmd ... command");
    puts("\targ ... argument");
    puts("");
+   puts("Prints the response of the server and exits with its return code,");
+   puts("or with -1 if no server answered.");
+   puts("");
 
    exit(0);
 }
 
 static int
-OpenUdpSocket(const char *host, unsigned short int port) {
+OpenUdpSocket(const char *host, unsigned short int port, struct sockaddr_in *server) {
    char addrstr[INET_ADDRSTRLEN];
    struct hostent *hent = NULL;
    struct sockaddr_in addr;
@@ -55,9 +65,8 @@ OpenUdpSocket(const char *host, unsigned short int port) {
       }
    }
 
-   if (connect(fd, (struct sockaddr *)&addr, sizeof (addr))) {
-      goto error;
-   }
+   // not connected, the reply comes from the server and not the broadcast address
+   *server = addr;
 
    return (fd);
 
@@ -70,13 +79,34 @@ error:
    return (-1);
 }
 
+static int
+WaitReply(int skt, const char *id, int timeout, char reply[], size_t size) {
+   struct pollfd pfd = { skt, POLLIN, 0 };
+   size_t len = strlen(id);
+   int received;
+
+   while (poll(&pfd, 1, timeout) > 0) {
+      if ((received = recv(skt, reply, size - 1, 0)) < 0) return (-1);
+
+      reply[received] = '\0';
+
+      // late replies to an earlier try carry the same id, others are ignored
+      if (!strncmp(reply, id, len) && (reply[len] == ' ')) {
+         memmove(reply, reply + len + 1, received - len);
+         return (0);
+      }
+   }
+
+   return (-1);
+}
+
 int
 main(int argc, char **argv) {
    const char *cmd = "";
    const char *arg = "";
-   unsigned int size;
-   char buffer[64];
-   int skt = NULL;
+   struct sockaddr_in server;
+   char buffer[128], reply[1024], id[16], *text;
+   int skt, size, timeout, code = -1;
 
    for (int i=1; i<argc; i++) {
       if (!strcmp(argv[i], "--help")) {
@@ -95,18 +125,45 @@ main(int argc, char **argv) {
       arg = argv[argc - 1];
    }
 
-   if ((skt = OpenUdpSocket(NULL, 1541)) >= 0) {
-      size = snprintf(buffer, 64, "%s %s", cmd, arg);
+   if ((skt = OpenUdpSocket(NULL, REMOTE_PORT, &server)) < 0) {
+      puts("could not connect to server, exiting.");
+      exit(-1);
+   }
+
+   // the id lets us tell our reply from the ones of other clients
+   snprintf(id, sizeof (id), "#%i", (int)getpid());
+
+   size = snprintf(buffer, sizeof (buffer), "%s %s %s", id, cmd, arg);
 
-      if (send(skt, buffer, size, 0) < 0) {
+   for (int try=0; (try<REMOTE_RETRIES) && (code < 0); try++) {
+      if (sendto(skt, buffer, size, 0, (struct sockaddr *)&server, sizeof (server)) < 0) {
          printf("error while sending data to server\n");
+         break;
       }
 
-      close(skt);
-   } else {
-      puts("could not connect to server, exiting.");
-      exit(-1);
+      timeout = REMOTE_TIMEOUT;
+
+      while (!WaitReply(skt, id, timeout, reply, sizeof (reply))) {
+         // "queued" is no answer yet, the projector is warming up or cooling down
+         if (!strncmp(reply, "queued", 6)) {
+            puts("queued, waiting for the projector ...");
+            timeout = REMOTE_PARK_TIMEOUT;
+            continue;
+         }
+
+         // "0 power on" or "5 serial read timeout"
+         code = strtol(reply, &text, 10);
+
+         if (*text == ' ') text++;
+         if (*text) puts(text);
+
+         break;
+      }
    }
 
-   return (0);
+   close(skt);
+
+   if (code < 0) puts("no reply from server.");
+
+   return (code);
 }